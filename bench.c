@@ -0,0 +1,119 @@
+/* make bench: hot routines timed in z80-sim on fixed fixtures */
+
+#include "main.c"
+
+static void bench_name(byte data) {
+    __asm__("out (#0xfd), a"); data;
+}
+
+static void bench_mark(void) __naked {
+    __asm__("out (#0xff), a");
+    __asm__("ret");
+}
+
+static void bench_start(const char *name) {
+    while (*name) bench_name(*name++);
+    bench_mark();
+}
+
+static void setup_rays(byte amount, byte spread, word pair) {
+    tail = 0;
+    head = amount;
+    paired = pair != 0;
+    for (word i = 0; i < 256; i++) {
+	ray[i] = (((i * spread) & 0x7f) << 5) | pair;
+    }
+}
+
+static void bench_field(const char *name, byte amount, byte spread,
+			word pair) {
+    setup_rays(amount, spread, pair);
+    bench_start(name);
+    draw_field();
+    bench_mark();
+}
+
+static const byte record[] = {
+    16, 0, 8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96, 104, 112, 120, 1,
+};
+
+void bench(void) {
+    SETUP_STACK();
+    __asm__("di");
+    precalculate();
+
+    bench_start("");
+    bench_mark();
+
+    bench_field("draw_field/16", 16, 37, 0);
+    bench_field("draw_field/64", 64, 37, 0);
+    bench_field("draw_field/255", 255, 37, 0);
+    /* the same 128 cells as single rays and as 64 pairs */
+    bench_field("draw_field/dense", 128, 1, 0);
+    bench_field("draw_field/pairs", 64, 2, PAIR);
+
+    head = 0;
+    current = record;
+    bench_start("update_field");
+    update_field();
+    bench_mark();
+
+    current = record;
+    repeat = 1;
+    stage_head = stage_tail = 0;
+    row_head = row_tail = 0;
+    bench_start("stage_row");
+    stage_row();
+    bench_mark();
+
+    head = 0;
+    bench_start("splice_row");
+    splice_row();
+    bench_mark();
+
+    pos = 0x123;
+    dir = 1;
+    clr = 0;
+    bench_start("draw_ship_part");
+    draw_ship_part(pos);
+    bench_mark();
+
+    bench_start("flip_bits");
+    flip_bits(0x5a);
+    bench_mark();
+
+    /* T/OUT is the decoder's T-states per screen byte written */
+    bench_start("draw_image");
+    draw_image(circuit, 1, 1, 8, 8);
+    bench_mark();
+
+    bench_start("draw_image/star");
+    draw_image(star, 9, 9, 6, 6);
+    bench_mark();
+
+    bench_start("put_char");
+    put_char('A', 0, 0, 0x42);
+    bench_mark();
+
+    bench_start("memset");
+    memset((byte *) map_y[0], 0, 0x800);
+    bench_mark();
+
+    bench_start("fill_bytes");
+    fill_bytes((byte *) map_y[0], 0, 0x800);
+    bench_mark();
+
+    bench_start("memcpy");
+    memcpy((byte *) map_y[0], (const byte *) line_data, 0x800);
+    bench_mark();
+
+    bench_start("clear_screen");
+    clear_screen();
+    bench_mark();
+
+    bench_start("clear_rows");
+    clear_rows(0);
+    bench_mark();
+
+    __asm__("halt");
+}
@@ -2,8 +2,6 @@ typedef signed char int8;
 typedef unsigned char byte;
 typedef unsigned short word;
 
-#define DEBUG
-
 #define ADDR(obj)	((word) (obj))
 #define BYTE(addr)	(* (volatile byte *) (addr))
 #define WORD(addr)	(* (volatile word *) (addr))
@@ -14,6 +12,8 @@ typedef unsigned short word;
 #define is_vsync()	vblank
 #define EDGE(x)		(edge + x)
 #define SPACE_DOWN()	!(in_fe(0x7f) & 0x01)
+#define CLEAR_SPACE()
+#define SPARE_TIME()	1
 #define SETUP_STACK()	__asm__("ld sp, #0xFDFC")
 #define IRQ_BASE	0xfe00
 #define TILE_SIZE	8
@@ -21,19 +21,72 @@ typedef unsigned short word;
 
 #ifdef CPC
 #define STREAK		20
+#define is_vsync()	vblank
 #define EDGE(x)		(edge + (x << 1))
-#define SPACE_DOWN()	!(cpc_keys() & 0x80)
+#define SPACE_DOWN()	space_down()
+#define CLEAR_SPACE()	(space = 0)
+#define SPARE_TIME()	(slot < 3)
+#define TILE_SIZE	16
+#ifdef DOUBLE_BUFFER
+#define SETUP_STACK()	__asm__("ld sp, #0x7DFC")
+#define IRQ_BASE	0x7E00
+#define SCREEN		(0xC000 ^ page_xor)
+#define LINE(x)		(byte *) (line_addr[x] ^ page_xor)
+#else
 #define SETUP_STACK()	__asm__("ld sp, #0x95FC")
 #define IRQ_BASE	0x9600
-#define TILE_SIZE	16
+#define SCREEN		0xC000
+#endif
 #endif
 
+#ifndef LINE
 #define LINE(x)		(byte *) (line_addr[x])
+#endif
+
+#if defined(DOUBLE_BUFFER) && !defined(CPC)
+#error "DOUBLE_BUFFER is for the CPC build"
+#endif
 
-#include "data.h"
+#ifdef ZXS
+#include "data-zxs.h"
+#endif
+#ifdef CPC
+#include "data-cpc.h"
+#endif
+
+static const byte bit_mask[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
 
 static volatile byte vblank;
+#ifdef DEBUG
+static volatile byte frames;
+static byte last_frame;
+static word missed;
+static byte dropped;
+#endif
+#ifdef CPC
+/* interrupt slot since vsync, 0 to 5, only gates the deferred jobs;
+ * the interrupts latch space and mark vsync, sound is stepped once a
+ * frame. The field is drawn whole: the ray ring is in emission order,
+ * bands by screen half would take a second ring or a second pass over
+ * every ray, so tear free output is left to DOUBLE_BUFFER */
+static volatile byte slot;
+static volatile byte space;
+#endif
+
+#ifdef DOUBLE_BUFFER
+static byte *screen_y[2][192];
+static byte **map_y;
+static word page_xor;
+static byte page;
+static byte visible;
+
+static word delta_line[16];
+static byte delta_data[16];
+static byte deltas;
+static byte last_tail, last_head;
+#else
 static byte *map_y[192];
+#endif
 
 static word counter;
 static byte level;
@@ -46,10 +99,17 @@ static byte dir;
 static byte key;
 static byte clr;
 static byte die;
+static byte starved;
 
 static word ray[256];
 static byte head, tail;
 
+/* a pair ray is a column and the next one emitted together, paired is
+ * set for levels whose stream has them, see save_diff() in tga-dump */
+#define PAIR		0x1000
+#define PAIRED		0x80
+static byte paired;
+
 void reset(void);
 static void (*emit_field)(void);
 
@@ -59,23 +119,108 @@ static const byte *wrap;
 static const byte *start;
 static const byte *current;
 
+/* rows decoded ahead of emit_generated, emits already shifted */
+#define ROWS	4
+static word stage[256];
+static byte stage_head, stage_tail;
+static byte row_amount[ROWS];
+static byte row_wait[ROWS];
+static byte row_head, row_tail;
+static byte staging;
+
+/* START_LEVEL and START_KEY jump straight to a keyframe of a level */
+#ifndef START_LEVEL
+#define START_LEVEL	0
+#endif
+#ifdef START_KEY
+#define KEY_SIZE	23
+static const byte *keys;
+static byte seek;
+#endif
+
 struct Level {
     void (*fn)(void);
     const char *msg;
 };
 
+struct Job {
+    void (*fn)(byte);
+    byte arg;
+};
+
+static struct Job job[32];
+static byte job_head, job_tail;
+
 static void interrupt(void) __naked {
 #ifdef ZXS
     __asm__("di");
     __asm__("push af");
     __asm__("ld a, #1");
     __asm__("ld (_vblank), a");
+#ifdef DEBUG
+    __asm__("ld a, (_frames)");
+    __asm__("inc a");
+    __asm__("ld (_frames), a");
+#endif
+    __asm__("pop af");
+    __asm__("ei");
+#endif
+#ifdef CPC
+    /* six per frame: latch space, count slots from the one in vsync */
+    __asm__("push af");
+    __asm__("push bc");
+    __asm__("call _cpc_keys");
+    __asm__("cpl");
+    __asm__("rlca");
+    __asm__("and a, #1");
+    __asm__("ld c, a");
+    __asm__("ld a, (_space)");
+    __asm__("or a, c");
+    __asm__("ld (_space), a");
+    __asm__("ld a, (_slot)");
+    __asm__("inc a");
+    __asm__("ld b, #0xf5");
+    __asm__("in c, (c)");
+    __asm__("rr c");
+    __asm__("jr nc, 00001$");
+    __asm__("ld a, #1");
+    __asm__("ld (_vblank), a");
+#ifdef DEBUG
+    __asm__("ld a, (_frames)");
+    __asm__("inc a");
+    __asm__("ld (_frames), a");
+#endif
+    __asm__("xor a, a");
+    __asm__("00001$:");
+    __asm__("ld (_slot), a");
+    __asm__("pop bc");
     __asm__("pop af");
     __asm__("ei");
 #endif
     __asm__("reti");
 }
 
+/* frame phases, numbers match phases[] in z80-sim.c */
+enum {
+    OTHER_PHASE, WAIT_PHASE, PLAYER_PHASE, EMIT_PHASE, FIELD_PHASE, NEXT_PHASE,
+};
+
+#ifdef PROFILE
+static void profile_phase(byte n) {
+    __asm__("out (#0xfb), a"); n;
+}
+
+static void profile_state(byte n) {
+    __asm__("out (#0xf9), a"); n;
+}
+#endif
+
+#if defined(PROFILE) || defined(DEBUG)
+#define PHASE(name)	mark_phase(name##_PHASE)
+#else
+#define PHASE(name)
+#endif
+
 static void __sdcc_call_hl(void) __naked {
     __asm__("jp (hl)");
 }
@@ -106,16 +251,13 @@ static void gate_array(byte reg) {
     __asm__("out (c), a"); reg;
 }
 
-static byte is_vsync(void) __naked {
-    __asm__("ld b, #0xf5");
-    __asm__("in a, (c)");
-    __asm__("and a, #1");
-    __asm__("ret");
-}
-
+/* keeps the caller's interrupt state, ld a, i copies IFF2 to P/V */
 static byte cpc_psg(byte reg, byte val) __naked {
-    __asm__("ld b, #0xf4");
     __asm__("ld c, a"); reg;
+    __asm__("ld a, i");
+    __asm__("push af");
+    __asm__("di");
+    __asm__("ld b, #0xf4");
     __asm__("out (c), c");
     __asm__("ld bc, #0xf6c0");
     __asm__("out (c), c");
@@ -128,6 +270,9 @@ static byte cpc_psg(byte reg, byte val) __naked {
     __asm__("out (c), c");
     __asm__("ld bc, #0xf600");
     __asm__("out (c), c");
+    __asm__("pop af");
+    __asm__("ret po");
+    __asm__("ei");
     __asm__("ret");
 }
 
@@ -153,6 +298,12 @@ static byte cpc_keys(void) __naked {
     __asm__("ret");
 }
 
+static byte space_down(void) {
+    byte down = space;
+    space = 0;
+    return down;
+}
+
 static const byte pal1[] = {
     0x9D, 0x10, 0x54, 0, 0x54, 1, 0x4D, 2, 0x4C, 3, 0x4A
 };
@@ -179,7 +330,9 @@ static void palette(byte num) {
 #endif
 
 static void delay_vblank(word ticks) {
-    for (word i = 0; i < ticks; i++) { if (is_vsync()) break; }
+    for (word i = 0; i < ticks; i++) { /* wcet: 64 */
+	if (is_vsync()) break;
+    }
 }
 
 #ifdef ZXS
@@ -243,23 +396,153 @@ static void level_sound(void) {
 #endif
 
 static void wait_vblank(void) {
-#ifdef CPC
-    crash_sound();
-    level_sound();
-#endif
-    while (!is_vsync()) {
 #ifdef ZXS
+    while (!is_vsync()) { /* wcet: idle */
 	crash_sound();
 	level_sound();
+    }
 #endif
+#ifdef CPC
+    crash_sound();
+    level_sound();
+    /* interrupts stay off from the test to the halt, ei only takes
+     * effect after the next instruction so the vsync cannot slip in */
+    __asm__("di");
+    while (!is_vsync()) { /* wcet: idle */
+	__asm__("ei");
+	__asm__("halt");
+	__asm__("di");
     }
+    __asm__("ei");
+#endif
     vblank = 0;
+#ifdef DEBUG
+    missed += (byte) (frames - last_frame - 1);
+    last_frame = frames;
+#endif
+}
+
+static word block_sp;
+static word block_len;
+
+/* push DE down from end, D blocks of 32 bytes of E (0 is 256) */
+static void fill_blocks(byte *end, word count_data) __naked {
+    __asm__("ld a, i"); end; count_data;
+    __asm__("di");
+    __asm__("push af");
+    __asm__("ld (_block_sp), sp");
+    __asm__("ld b, d");
+    __asm__("ld d, e");
+    __asm__("ld sp, hl");
+    __asm__("00001$:");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("push de");
+    __asm__("djnz 00001$"); /* wcet: 256 */
+    __asm__("ld sp, (_block_sp)");
+    __asm__("pop af");
+    __asm__("ret po");
+    __asm__("ei");
+    __asm__("ret");
+}
+
+/* block_len bytes, odd part with ldir then 16 ldi per turn */
+static void copy_blocks(byte *dst, const byte *src) __naked {
+    __asm__("ex de, hl"); dst; src;
+    __asm__("ld bc, (_block_len)");
+    __asm__("ld a, c");
+    __asm__("and a, #15");
+    __asm__("jr z, 00001$");
+    __asm__("push bc");
+    __asm__("ld c, a");
+    __asm__("ld b, #0");
+    __asm__("ldir");
+    __asm__("pop bc");
+    __asm__("ld a, c");
+    __asm__("and a, #0xf0");
+    __asm__("ld c, a");
+    __asm__("00001$:");
+    __asm__("ld a, b");
+    __asm__("or a, c");
+    __asm__("ret z");
+    __asm__("00002$:");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("ldi");
+    __asm__("jp pe, 00002$"); /* wcet: 1024 */
+    __asm__("ret");
+}
+
+/* the byte loop the block engine replaced, kept to compare against */
+static void fill_bytes(byte *ptr, byte data, word len) {
+    while (len-- > 0) { *ptr++ = data; } /* wcet: 16384 */
 }
 
 static void memset(byte *ptr, byte data, word len) {
-    while (len-- > 0) { *ptr++ = data; }
+    byte *end = ptr + len;
+    while (len >= 32) { /* wcet: 2 */
+	word n = len < 0x2000 ? len & ~31 : 0x2000;
+	fill_blocks(end, (n << 3) | data);
+	end -= n;
+	len -= n;
+    }
+    while (len-- > 0) { *ptr++ = data; } /* wcet: 31 */
+}
+
+static void memcpy(byte *dst, const byte *src, word len) {
+    block_len = len;
+    copy_blocks(dst, src);
 }
 
+#ifdef DOUBLE_BUFFER
+static void crtc(byte reg, byte val) __naked {
+    __asm__("ld b, #0xbc");
+    __asm__("out (c), a"); reg;
+    __asm__("ld b, #0xbd");
+    __asm__("out (c), l"); val;
+    __asm__("ret");
+}
+
+/* pages 0xC000 and 0x8000, everything draws to page */
+static void set_page(byte n) {
+    map_y = screen_y[n];
+    page_xor = n ? 0x4000 : 0;
+    page = n;
+}
+
+/* latched by the CRTC at the next frame start, after vsync */
+static void show_page(byte n) {
+    crtc(12, n ? 0x23 : 0x33);
+    visible = n;
+}
+#endif
+
 static void setup_system(void) {
     byte top = (byte) ((IRQ_BASE >> 8) - 1);
     word jmp_addr = (top << 8) | top;
@@ -279,19 +562,31 @@ static void setup_system(void) {
     __asm__("ld bc, #0xbdd4");
     __asm__("out (c), c");
 
+#ifdef DOUBLE_BUFFER
+    show_page(0);
+    set_page(0);
+#endif
     cpc_psg(7, 0xB8);
     cpc_psg(8, 0x00);
 #endif
 }
 
+/* fill engine per area, -DSCREEN_FILL=fill_bytes for the byte loop */
+#ifndef SCREEN_FILL
+#define SCREEN_FILL	memset
+#endif
+#ifndef ATTR_FILL
+#define ATTR_FILL	memset
+#endif
+
 static void clear_screen(void) {
 #ifdef ZXS
-    memset((byte *) 0x5800, 0x00, 0x300);
-    memset((byte *) 0x4000, 0x00, 0x1800);
+    ATTR_FILL((byte *) 0x5800, 0x00, 0x300);
+    SCREEN_FILL((byte *) 0x4000, 0x00, 0x1800);
     out_fe(0);
 #endif
 #ifdef CPC
-    memset((byte *) 0xC000, 0x00, 0x4000);
+    SCREEN_FILL((byte *) SCREEN, 0x00, 0x4000);
     palette(1);
 #endif
 }
@@ -304,7 +599,12 @@ static void precalculate(void) {
 #endif
 #ifdef CPC
 	word f = ((y & 7) << 11) | mul80(y >> 3);
+#ifdef DOUBLE_BUFFER
+	screen_y[1][y] = (byte *) (0x8000 + f);
+	screen_y[0][y] = (byte *) (0xC000 + f);
+#else
 	map_y[y] = (byte *) (0xC000 + f);
+#endif
 #endif
     }
 }
@@ -332,12 +632,66 @@ static void put_char(char symbol, byte x, byte y, byte color) {
 #endif
 }
 
+/* UI work deferred to spare frame time, one job per frame and at
+ * least one every JOB_EVERY frames when there is never time to spare */
+#define JOB_EVERY	8
+
+/* at most 16 are pending: 8 clear_rows, put_name for the 7 letters of
+ * a level name and lost_life; a full ring drops the job, DEBUG counts */
+static void defer(void (*fn)(byte), byte arg) {
+    if ((byte) (job_head - job_tail) == SIZE(job)) {
+#ifdef DEBUG
+	dropped++;
+#endif
+	return;
+    }
+    struct Job *ptr = job + (job_head++ & (SIZE(job) - 1));
+    ptr->fn = fn;
+    ptr->arg = arg;
+}
+
+/* jobs run once and copy what they wrote into the other page */
+static byte run_job(void) {
+    if (job_tail == job_head) return 0;
+    struct Job *ptr = job + (job_tail++ & (SIZE(job) - 1));
+    ptr->fn(ptr->arg);
+    return 1;
+}
+
+#ifdef DOUBLE_BUFFER
+static void mirror_cell(byte x, byte y) {
+    x = x << 1;
+    y = y << 3;
+    for (byte i = 0; i < 8; i++) {
+	byte *src = map_y[y++] + x;
+	byte *dst = (byte *) ((word) src ^ 0x4000);
+	dst[0] = src[0];
+	dst[1] = src[1];
+    }
+}
+#else
+#define mirror_cell(x, y)
+#endif
+
 static void put_str(const char *msg, byte x, byte y, byte color) {
-    while (*msg != 0) {
+    while (*msg != 0) { /* wcet: 32 */
 	put_char(*(msg++), x++, y, color);
     }
 }
 
+/* tga-dump -s text, a new line starts at x again */
+static void put_text(const byte *text, byte x, byte y, byte color) {
+    for (byte i = x; *text != 0; text++) {
+	if (*text == '\n') {
+	    i = x;
+	    y++;
+	}
+	else {
+	    put_char(*text, i++, y, color);
+	}
+    }
+}
+
 #ifdef DEBUG
 static char to_hex(byte digit) {
     return (digit < 10) ? '0' + digit : 'A' + digit - 10;
@@ -351,10 +705,72 @@ static void put_num(word num, byte x, byte y, byte color) {
     }
     put_str(msg, x, y, color);
 }
+
+/* border colour per frame phase, raster bars on real hardware */
+static void raster(byte phase) {
+#ifdef ZXS
+    static const byte border[] = { 0, 0, 2, 4, 1, 6 };
+    out_fe(border[phase]);
+#endif
+#ifdef CPC
+    static const byte border[] = { 0x54, 0x54, 0x4C, 0x56, 0x44, 0x4A };
+    gate_array(0x10);
+    gate_array(border[phase]);
+#endif
+}
+
+/* one value per frame: live rays, counter, level offset, missed and
+ * dropped jobs */
+static void overlay(void) {
+    static byte item;
+    word value;
+    if (++item >= 5) item = 0;
+    byte n = item;
+    switch (n) {
+    case 0:
+	value = (byte) (head - tail);
+	break;
+    case 1:
+	value = counter;
+	break;
+    case 2:
+	value = current - start;
+	break;
+    case 3:
+	value = missed;
+	break;
+    default:
+	value = dropped;
+	break;
+    }
+    put_num(value, 28, n, 0x42);
+}
+#endif
+
+#ifdef PROFILE
+/* live rays, level and crash counter for z80-sim -r, once a frame */
+static void report_state(void) {
+    profile_state(head - tail);
+    profile_state(level);
+    profile_state(die);
+}
 #endif
 
+#if defined(PROFILE) || defined(DEBUG)
+static void mark_phase(byte n) {
+#ifdef PROFILE
+    profile_phase(n);
+#endif
+#ifdef DEBUG
+    raster(n);
+#endif
+}
+#endif
+
+/* unpacks tga-dump -z token stream, see pack_buffer() */
 static void draw_image(const byte *img, byte x, byte y, byte w, byte h) {
-    word i = 0;
+    byte op = 0, up = 0, value = 0, count = 0;
+    const byte *from = 0;
     y = y << 3;
     h = h << 3;
 #ifdef CPC
@@ -363,17 +779,43 @@ static void draw_image(const byte *img, byte x, byte y, byte w, byte h) {
 #endif
     for (byte dy = y; dy < y + h; dy++) {
 	byte *addr = map_y[dy] + x;
+	if (op & 0x80) from = map_y[dy - up] + x;
 	for (byte dx = 0; dx < w; dx++) {
-	    *addr++ = img[i++];
+	    if (count == 0) {
+		op = *img++;
+		if (op & 0x80) {
+		    up = *img++;
+		    from = map_y[dy - up] + x + dx;
+		    count = op - 0x7f;
+		}
+		else {
+		    if (op & 0x40) value = *img++;
+		    count = (op & 0x3f) + 1;
+		}
+	    }
+	    if (op & 0x80) {
+		value = *from++;
+	    }
+	    else if (!(op & 0x40)) {
+		value = *img++;
+	    }
+	    *addr++ = value;
+	    count--;
 	}
     }
 #ifdef ZXS
     for (byte dy = y; dy < y + h; dy += 8) {
-	for (byte dx = x; dx < x + w; dx++) {
-	    byte attribute = img[i++];
-	    if (attribute != 0) {
-		BYTE(0x5800 + (dy << 2) + dx) = attribute;
+	byte *attr = (byte *) 0x5800 + (dy << 2) + x;
+	for (byte dx = 0; dx < w; dx++) {
+	    if (count == 0) {
+		op = *img++;
+		if (op & 0x40) value = *img++;
+		count = (op & 0x3f) + 1;
 	    }
+	    if (!(op & 0x40)) value = *img++;
+	    if (value != 0) *attr = value;
+	    attr++;
+	    count--;
 	}
     }
 #endif
@@ -397,40 +839,91 @@ static void draw_tile(const byte *img, byte x, byte y, byte color) {
 #endif
 }
 
-static const char * const intro[] = {
-    "Tsk, tsk, yet again you have run",
-    "into trouble with the galactic",
-    "police, but this time you would",
-    "rather die than go back to jail.",
-    "Ahead of you lies PULZAR. Only",
-    "a mad man might use its gravity",
-    "to slingshot one's ship away.",
-    "", "  Will you be able to escape?",
-    "", "      Press SPACE to PLAY",
-};
+#define FLIP_H		0x40
+#define FLIP_V		0x80
 
+static byte flip_bits(byte source);
+static void draw_tilemap(const byte *tiles, const byte *map,
+			 byte x, byte y, byte w, byte h) {
+    for (byte j = y; j < y + h; j++) {
+	for (byte i = x; i < x + w; i++) {
+	    byte entry = *map++;
+	    const byte *tile = tiles + (entry & 0x3f) * TILE_SIZE;
+	    byte dy = j << 3;
+#ifdef CPC
+	    byte dx = i << 1;
+#else
+	    byte dx = i;
+#endif
+	    for (byte row = 0; row < 8; row++) {
+		byte n = (entry & FLIP_V) ? 7 - row : row;
+		byte *addr = map_y[dy + row] + dx;
+#ifdef ZXS
+		byte data = tile[n];
+		*addr = (entry & FLIP_H) ? flip_bits(data) : data;
+#endif
+#ifdef CPC
+		const byte *src = tile + (n << 1);
+		if (entry & FLIP_H) {
+		    addr[0] = flip_bits(src[1]);
+		    addr[1] = flip_bits(src[0]);
+		}
+		else {
+		    addr[0] = src[0];
+		    addr[1] = src[1];
+		}
+#endif
+	    }
+#ifdef ZXS
+	    byte attribute = *map++;
+	    if (attribute != 0) BYTE(0x5800 + (j << 5) + i) = attribute;
+#endif
+	}
+    }
+}
+
+#ifdef COLD_BASE
+/* title art and texts are packed in the blob, see pack_cold(), and
+ * unpacked to scratch RAM only for the screens outside the game */
+static void load_overlay(void) {
+    const byte *src = cold;
+    byte *dst = (byte *) COLD_BASE;
+    while (src != cold + sizeof(cold)) {
+	byte op = *src++;
+	if (op & 0x80) {
+	    const byte *from = dst - *src++;
+	    for (byte n = op - 0x7f; n != 0; n--) *dst++ = *from++;
+	}
+	else if (op & 0x40) {
+	    byte value = *src++;
+	    for (byte n = (op & 0x3f) + 1; n != 0; n--) *dst++ = value;
+	}
+	else {
+	    for (byte n = op + 1; n != 0; n--) *dst++ = *src++;
+	}
+    }
+}
+#else
+#define load_overlay()
+#endif
+
+/* the CPC latch holds presses from frames nobody read, drop them */
 static void wait_space(void) {
+    CLEAR_SPACE();
     while (!SPACE_DOWN()) { }
 }
 
 static void draw_title(void) {
-    draw_image(title, 4, 3, 24, 5);
-    for (byte i = 0; i < SIZE(intro); i++) {
-	put_str(intro[i], 0, 10 + i, 0x42);
-    }
+    load_overlay();
+    draw_tilemap(title_tiles, title_map, 4, 3, 24, 5);
+    put_text(intro, 0, 10, 0x42);
     wait_space();
 }
 
-static const char * const lose[] = {
-    "All of us are cosmic dust, but",
-    "some more literally than others.",
-};
-
 static void game_over(void) {
+    load_overlay();
     put_str("GAME OVER", 11, 10, 0x42);
-    for (byte i = 0; i < SIZE(lose); i++) {
-	put_str(lose[i], 0, 12 + i, 0x42);
-    }
+    put_text(lose, 0, 12, 0x42);
     wait_space();
 }
 
@@ -509,7 +1002,7 @@ static void flip_H(byte x1, byte y1, byte x2, byte y2, byte w, byte h) {
 static void draw_level_tab(void);
 static void draw_hud(void) {
 #ifdef ZXS
-    memset((byte *) 0x5800, 0x42, 0x300);
+    ATTR_FILL((byte *) 0x5800, 0x42, 0x300);
 #endif
 #ifdef CPC
     palette(2);
@@ -545,8 +1038,13 @@ static void draw_hud(void) {
     draw_level_tab();
 }
 
+static void lost_life(byte pos) {
+    life_sprite(0x40, pos);
+    mirror_cell(0x16 - pos, 0x17);
+}
+
 static void take_life(void) {
-    if (--lives >= 0) life_sprite(0x40, lives);
+    if (--lives >= 0) defer(&lost_life, lives);
 }
 
 static inline byte check_collision(byte prev, byte data) {
@@ -554,6 +1052,18 @@ static inline byte check_collision(byte prev, byte data) {
     return clr ? mask != data : mask;
 }
 
+#ifdef DOUBLE_BUFFER
+/* non-field writes of this frame, replayed into the other page */
+static void log_delta(word i, byte data) {
+    if (deltas < SIZE(delta_data)) {
+	delta_line[deltas] = i;
+	delta_data[deltas++] = data;
+    }
+}
+#else
+#define log_delta(i, data)
+#endif
+
 static void draw_ship_part(word i) {
     i = i & 0xfff;
     byte prev = *LINE(i);
@@ -565,6 +1075,7 @@ static void draw_ship_part(word i) {
 #endif
     if (check_collision(prev, data)) die = 1;
     *LINE(i) = prev ^ data;
+    log_delta(i, data);
 }
 
 static void draw_whole_ship(byte clear_ship) {
@@ -593,6 +1104,7 @@ static void draw_scrap(word i) {
     data = data << 4;
 #endif
     *LINE(i) = prev ^ data;
+    log_delta(i, data);
 }
 
 static void draw_debris(byte time) {
@@ -625,15 +1137,71 @@ static void draw_player(void) {
     }
 }
 
+/* one read-modify-write when both columns land in the same byte */
+static inline void draw_pair(word r) {
+    byte *next = LINE(r + 32);
+    byte data = line_data[r + 32];
+    if (next == LINE(r)) data ^= line_data[r];
+    else *LINE(r) ^= line_data[r];
+    *next ^= data;
+}
+
 static void draw_field(void) {
     byte i = tail;
-    while (i != head) {
+#ifdef DOUBLE_BUFFER
+    last_tail = tail;
+    last_head = head;
+#endif
+    if (paired) {
+	while (i != head) { /* wcet: 255 */
+	    word r = ray[i++]++;
+	    if (r & PAIR) draw_pair(r & 0xfff);
+	    else *LINE(r) ^= line_data[r];
+	    if ((r & 0x1f) == 0x1f) tail++;
+	}
+	return;
+    }
+    while (i != head) { /* wcet: 255 */
 	word r = ray[i++]++;
 	*LINE(r) ^= line_data[r];
 	if ((r & 0x1f) == 0x1f) tail++;
     }
 }
 
+#ifdef DOUBLE_BUFFER
+/* bring the back page from two frames ago up to the last frame */
+static void replay_frame(void) {
+    for (byte i = last_tail; i != last_head; i++) { /* wcet: 255 */
+	word r = ray[i] - 1;
+	if (r & PAIR) draw_pair(r & 0xfff);
+	else *LINE(r) ^= line_data[r];
+    }
+    for (byte i = 0; i < deltas; i++) { /* wcet: 16 */
+	*LINE(delta_line[i]) ^= delta_data[i];
+    }
+    deltas = 0;
+}
+
+/* copy the page being drawn to the other one, nothing left to replay */
+static void mirror_page(void) {
+    word back = SCREEN;
+    memcpy((byte *) (back ^ 0x4000), (byte *) back, 0x4000);
+    last_tail = last_head = deltas = 0;
+    set_page(visible ^ 1);
+}
+
+static void flip_page(void) {
+    show_page(page);
+    set_page(page ^ 1);
+}
+
+/* back to drawing straight into the shown page */
+static void single_page(void) {
+    show_page(page);
+    wait_vblank();
+}
+#endif
+
 static void load_level(void);
 static void advance_level(void) {
     level++;
@@ -668,7 +1236,7 @@ static void emit_whirlpool(word next, int8 dir) {
     const byte w = 10;
     word i = next << 5;
     if (counter == 0) {
-	for (byte n = 0; n < w; n++) {
+	for (byte n = 0; n < w; n++) { /* wcet: 10 */
 	    push_whirlpool(i);
 	    i = i + dir;
 	}
@@ -678,7 +1246,7 @@ static void emit_whirlpool(word next, int8 dir) {
 	push_whirlpool(i);
     }
     else {
-	for (byte n = 0; n < w; n++) {
+	for (byte n = 0; n < w; n++) { /* wcet: 10 */
 	    i = i + dir;
 	    push_whirlpool(i);
 	}
@@ -739,29 +1307,15 @@ static const word chord[] = {
 };
 
 static byte is_vblank_start(void) {
-#ifdef ZXS
     byte ret = vblank;
     if (ret) vblank = 0;
     return ret;
-#endif
-#ifdef CPC
-    byte new = is_vsync();
-    byte old = vblank;
-    vblank = new;
-    return new && !old;
-#endif
 }
 
 static void delay(word loops) {
     for (word i = 0; i < loops; i++) { }
 }
 
-static const char * const outro[] = {
-    " Unbelievable! You did it.",
-    "You crazy son of a Belgium,",
-    "        You did it!",
-};
-
 static void reverse(void) {
     word *addr = (word *) (word) line_addr;
     byte *data = (byte *) (word) line_data;
@@ -865,12 +1419,10 @@ static void beeper(struct Channel *channel) {
 
 static void finish_game(void) {
     clear_screen();
+    load_overlay();
     put_str("GAME COMPLETE", 9, 12, 0x42);
-    draw_image(title, 4, 3, 24, 5);
-
-    for (byte i = 0; i < SIZE(outro); i++) {
-	put_str(outro[i], 2, 17 + i, 0x42);
-    }
+    draw_tilemap(title_tiles, title_map, 4, 3, 24, 5);
+    put_text(outro, 2, 17, 0x42);
 
     static struct Channel channels[2];
     for (byte i = 0; i < SIZE(channels); i++) {
@@ -881,6 +1433,7 @@ static void finish_game(void) {
     }
 
     music_done = 0;
+    CLEAR_SPACE();
     while (!SPACE_DOWN()) {
 	if (!music_done) {
 	    beeper(channels);
@@ -935,13 +1488,16 @@ static void hyperspace_streaks(word *lines, byte clear) {
 }
 
 static word addr_of(word i) {
-    return line_addr[i & 0xfff];
+    return (word) LINE(i & 0xfff);
 }
 
-static void emit_slinger(void) {
+static void emit_slinger(void) { /* wcet: skip */
     byte faster = 0;
     byte close = 0;
     byte speed = 32;
+#ifdef DOUBLE_BUFFER
+    single_page();
+#endif
     while (!launch_position()) {
 	wait_vblank();
 	draw_whole_ship(1);
@@ -970,7 +1526,7 @@ static void emit_slinger(void) {
 
 static void update_field(void) {
     byte amount = *(current++);
-    for (byte i = 0; i < amount; i++) {
+    for (byte i = 0; i < amount; i++) { /* wcet: 128 */
 	word emit = *(current++);
 	ray[head++] = emit << 5;
     }
@@ -982,72 +1538,146 @@ static void emit_cleanup(void) {
     emit_field = &emit_emptiness;
 }
 
+/* next row and the wait after it, wrapping while repeats are left */
+static void stage_row(void) {
+    byte n = row_head++ & (ROWS - 1);
+    byte amount = *(current++);
+    row_amount[n] = amount;
+    for (byte i = 0; i < amount; i++) { /* wcet: 128 */
+	word emit = *(current++);
+	stage[stage_head++] = emit << 5;
+    }
+    amount = *(current++);
+    if (amount == 0 && repeat > 1) {
+	repeat--;
+	current = wrap;
+	amount = *(current++);
+    }
+    row_wait[n] = amount;
+    staging = amount != 0;
+}
+
+static byte can_stage(void) {
+    byte rows = row_head - row_tail;
+    byte room = stage_tail - stage_head - 1;
+    return staging && rows < ROWS && *current <= room;
+}
+
+static void splice_row(void) {
+    if (row_head == row_tail) stage_row();
+    byte n = row_tail++ & (ROWS - 1);
+    for (byte i = row_amount[n]; i != 0; i--) { /* wcet: 128 */
+	ray[head++] = stage[stage_tail++];
+    }
+    wait = row_wait[n];
+}
+
+/* idle frames decode ahead, so busy ones only copy */
 static void emit_generated(void) {
     wait--;
     if (wait == 0) {
-	update_field();
-	wait = *(current++);
-	if (wait == 0) {
-	    if (repeat > 1) {
-		repeat--;
-		current = wrap;
-		wait = *(current++);
-	    }
-	    else {
-		emit_field = &emit_cleanup;
-	    }
-	}
+	splice_row();
+	if (wait == 0) emit_field = &emit_cleanup;
+    }
+    else if (can_stage()) {
+	stage_row();
     }
 }
 
-static void load_generated(byte n, const byte *ptr) {
-    repeat = n;
+#ifdef START_KEY
+static void draw_ray(word r, byte steps) {
+    for (; steps != 0; steps--) { /* wcet: 32 */
+	*LINE(r) ^= line_data[r];
+	r++;
+    }
+}
+
+/* keyframe n from tga-dump: stream position, rays in flight and the
+ * columns whose rays have finished, all drawn in one long frame */
+static void seek_key(byte n) { /* wcet: skip */
+    const byte *key = keys + 2;
+    if (n >= keys[1]) return;
+    for (; n != 0; n--) key += KEY_SIZE + 2 * key[KEY_SIZE - 1];
+    counter = WORD(key);
+    current = start + WORD(key + 2);
+    wait = key[4];
+    repeat = key[5];
+    for (byte i = 0; i < 128; i++) {
+	if (key[6 + (i >> 3)] & bit_mask[i & 7]) draw_ray(i << 5, 32);
+    }
+    head = tail = 0;
+    const byte *rays = key + KEY_SIZE;
+    for (byte i = key[KEY_SIZE - 1]; i != 0; i--) {
+	word r = WORD(rays);
+	rays += 2;
+	ray[head++] = r;
+	draw_ray(r & 0xfe0, r & 0x1f);
+	if (r & PAIR) draw_ray((r & 0xfe0) + 32, r & 0x1f);
+    }
+#ifdef DOUBLE_BUFFER
+    mirror_page();
+#endif
+}
+#endif
+
+/* index holds the repeat count and the keyframes of the stream */
+static void load_generated(const byte *ptr, const byte *index) {
+    repeat = index[0] & ~PAIRED;
+    paired = index[0] & PAIRED;
     start = ptr;
     current = ptr;
     update_field();
     wrap = current;
     wait = *(current++);
+    stage_head = stage_tail = 0;
+    row_head = row_tail = 0;
+    staging = 1;
     emit_field = &emit_generated;
+#ifdef START_KEY
+    keys = index;
+    if (seek) seek_key(seek - 1);
+    seek = 0;
+#endif
 }
 
 static void emit_squigle(void) {
-    load_generated(8, squiggly);
+    load_generated(squiggly, squiggly_keys);
 }
 
 static void emit_diamond(void) {
-    load_generated(1, diamonds);
+    load_generated(diamonds, diamonds_keys);
 }
 
 static void emit_rings(void) {
-    load_generated(7, rings);
+    load_generated(rings, rings_keys);
 }
 
 static void emit_gamma(void) {
-    load_generated(8, gamma);
+    load_generated(gamma, gamma_keys);
 }
 
 static void emit_curve(void) {
-    load_generated(2, curve);
+    load_generated(curve, curve_keys);
 }
 
 static void emit_twinkle(void) {
-    load_generated(3, twinkle);
+    load_generated(twinkle, twinkle_keys);
 }
 
 static void emit_number(void) {
-    load_generated(1, number);
+    load_generated(number, number_keys);
 }
 
 static void emit_bubbles(void) {
-    load_generated(1, bubbles);
+    load_generated(bubbles, bubbles_keys);
 }
 
 static void emit_solaris(void) {
-    load_generated(2, solaris);
+    load_generated(solaris, solaris_keys);
 }
 
 static void emit_radiate(void) {
-    load_generated(2, radiate);
+    load_generated(radiate, radiate_keys);
 }
 
 static const struct Level level_list[] = {
@@ -1088,25 +1718,55 @@ static void draw_level_tab(void) {
     flip_V(1, 120, 24, (y2 << 3) + 8, 2, 24);
 }
 
+static void put_name(byte arg) {
+    byte i = arg & 7;
+    byte n = arg >> 3;
+    put_char(level_list[n].msg[i], 24 + i, text_pos(n), 0x02);
+    mirror_cell(24 + i, text_pos(n));
+}
+
 static void load_level(void) {
     if (level < SIZE(level_list)) {
-	put_str(level_list[level].msg, 24, text_pos(level), 0x02);
+	const char *msg = level_list[level].msg;
+	for (byte i = 0; msg[i] != 0; i++) { /* wcet: 8 */
+	    defer(&put_name, (level << 3) | i);
+	}
 	emit_field = level_list[level].fn;
+	paired = 0;
+	CLEAR_SPACE();
     }
 }
 
-static void clear_field(void) {
-    for (byte y = 0; y < 32; y++) {
+/* the field is stopped, both pages hold the same rows */
+static void clear_rows(byte y) {
+    for (byte end = y + 4; y < end; y++) { /* wcet: 4 */
 	for (word x = 0; x < 0x1000; x += 32) {
 	    byte data = line_data[x + y];
 #ifdef CPC
 	    data = data | (data << 4);
 #endif
-	    *LINE(x + y) &= ~data;
+	    byte *ptr = LINE(x + y);
+	    *ptr &= ~data;
+#ifdef DOUBLE_BUFFER
+	    BYTE((word) ptr ^ 0x4000) &= ~data;
+#endif
 	}
     }
 }
 
+static void clear_field(void) {
+    for (byte y = 0; y < 32; y += 4) defer(&clear_rows, y);
+}
+
+/* past the debris the field stops, its rows are cleared one job per
+ * frame while the crash plays out instead of before the restart */
+#define CLEAR_DIE	16
+
+static void stop_field(void) {
+    tail = head;
+    clear_field();
+}
+
 static void init_variables(void) {
     head = tail = 0;
     counter = 0;
@@ -1116,26 +1776,69 @@ static void init_variables(void) {
     dir = 1;
     key = 1;
     die = 0;
+    starved = 0;
 }
 
 static void reset_variables(void) {
-    level = 0;
+    level = START_LEVEL;
     lives = 5;
 }
 
 static void game_loop(void) {
+    while (run_job()) wait_vblank(); /* wcet: 32 */
+#ifdef START_KEY
+    /* every retry of the start level goes back to the keyframe */
+    seek = level == START_LEVEL ? START_KEY : 0;
+#endif
     load_level();
     init_variables();
     draw_whole_ship(0);
-    while (die < 32) {
+#ifdef DOUBLE_BUFFER
+    mirror_page();
+#endif
+    while (die < 32) { /* wcet: frame */
+	PHASE(WAIT);
 	wait_vblank();
+#ifdef DOUBLE_BUFFER
+	replay_frame();
+#endif
+	/* before draw_field, so no rays are left to replay over the clear */
+	if (die == CLEAR_DIE) stop_field();
+#ifdef EARLY_FIELD
+	/* screen writes in the top border, before contention starts;
+	 * the ship then collides with this frame's field, not the last */
+	PHASE(FIELD);
+	draw_field();
+#endif
+	PHASE(PLAYER);
 	draw_player();
-	emit_field();
+	PHASE(EMIT);
+	if (die < CLEAR_DIE) emit_field();
+#ifndef EARLY_FIELD
+	PHASE(FIELD);
 	draw_field();
+#endif
+	PHASE(NEXT);
 	next_field();
+#ifdef DEBUG
+	overlay();
+#endif
+#ifdef PROFILE
+	report_state();
+#endif
+	if (SPARE_TIME() || die >= CLEAR_DIE || ++starved == JOB_EVERY) {
+	    run_job();
+	    starved = 0;
+	}
 	counter++;
+#ifdef DOUBLE_BUFFER
+	flip_page();
+#endif
     }
-    clear_field();
+#ifdef DOUBLE_BUFFER
+    single_page();
+#endif
+    PHASE(OTHER);
 }
 
 void reset(void) {
@@ -1153,6 +1856,7 @@ void reset(void) {
 	game_loop();
 	take_life();
     }
+    while (run_job()) { } /* wcet: 32 */
     clear_screen();
     game_over();
     reset();
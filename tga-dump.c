@@ -5,15 +5,25 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <pthread.h>
 
 // #define DEBUG
 
+enum Target { ZXS, CPC };
+static const char *targets[] = { "zxs", "cpc" };
+
 static char *file_name;
+static int target;
 static int color_index = 1;
+static int pack;
 static unsigned char inkmap[256];
 static unsigned char colors[256];
 
 #define GOLDEN 1.618033
+#define CACHE ".assets"
 
 struct Header {
     unsigned char id;
@@ -25,6 +35,79 @@ struct Header {
     unsigned char desc;
 };
 
+struct Image {
+    int fd;
+    struct Header header;
+    unsigned char data[4096];
+    int size, pos;
+    int packet, run;
+    unsigned char value;
+    int row;
+};
+
+static unsigned char read_byte(struct Image *image) {
+    if (image->pos == image->size) {
+	image->size = read(image->fd, image->data, sizeof(image->data));
+	image->pos = 0;
+	if (image->size <= 0) {
+	    fprintf(stderr, "ERROR: %s is truncated\n", file_name);
+	    exit(-EIO);
+	}
+    }
+    return image->data[image->pos++];
+}
+
+static void read_pixels(struct Image *image, unsigned char *buf, int size) {
+    if (image->header.image_type == 3) {
+	for (int i = 0; i < size; i++) buf[i] = read_byte(image);
+	return;
+    }
+    for (int i = 0; i < size; i++) {
+	if (image->packet == 0) {
+	    unsigned char packet = read_byte(image);
+	    image->packet = (packet & 0x7f) + 1;
+	    image->run = packet & 0x80;
+	    if (image->run) image->value = read_byte(image);
+	}
+	buf[i] = image->run ? image->value : read_byte(image);
+	image->packet--;
+    }
+}
+
+static int open_image(struct Image *image, char *name) {
+    memset(image, 0, sizeof(*image));
+    image->fd = open(name, O_RDONLY);
+    if (image->fd < 0) {
+	fprintf(stderr, "ERROR: unable to open %s\n", name);
+	return -ENOENT;
+    }
+
+    struct Header *header = &image->header;
+    unsigned char *raw = (unsigned char *) header;
+    for (int i = 0; i < sizeof(*header); i++) raw[i] = read_byte(image);
+    if ((header->image_type != 3 && header->image_type != 11)
+	|| header->depth != 8) {
+	fprintf(stderr, "ERROR: %s is not a grayscale 8-bit TGA\n", name);
+	return -EINVAL;
+    }
+    if ((header->w & 7) || (header->h & 7) || !(header->desc & 0x20)) {
+	fprintf(stderr, "ERROR: %s is not top-down in 8x8 cells\n", name);
+	return -EINVAL;
+    }
+
+    unsigned char *map = header->color_map;
+    int skip = header->id + (map[2] | map[3] << 8) * ((map[4] + 7) / 8);
+    for (int i = 0; i < skip; i++) read_byte(image);
+    return 0;
+}
+
+static int read_strip(struct Image *image, unsigned char *strip) {
+    if (image->row >= image->header.h) return 0;
+    read_pixels(image, strip, 8 * image->header.w);
+    image->row += 8;
+    return 1;
+}
+
 #ifdef DEBUG
 static void hexdump(unsigned char *buf, int size) {
     for (int i = 0; i < size; i++) {
@@ -88,10 +171,6 @@ static unsigned short on_pixel(unsigned char *buf, int i, int w) {
     return pixel == 0 ? 0x1 : pixel;
 }
 
-static int ink_index(struct Header *header, int i) {
-    return (i / header->w / 8) * (header->w / 8) + i % header->w / 8;
-}
-
 static unsigned char encode_ink(unsigned short colors) {
     unsigned char f = inkmap[colors & 0xff];
     unsigned char b = inkmap[colors >> 8];
@@ -106,7 +185,65 @@ static int has_any_color(void) {
     return 0;
 }
 
+static int column;
+static int binary;
+
+struct Array {
+    const char *type;
+    char name[256];
+    int align;
+    int size, capacity;
+    unsigned char *data;
+    int cold;
+};
+
+static struct Array array;
+
+/*
+ * With -m target@top every array goes out as a binary record:
+ * "type name align size\n" followed by size raw bytes.
+ */
+static void open_array(const char *type, char *name, int align) {
+    if (binary) {
+	array.type = type;
+	strcpy(array.name, name);
+	array.align = align;
+	array.size = 0;
+	return;
+    }
+    printf("const %s %s[] = {\n", type, name);
+    column = 0;
+}
+
+static void break_line(void) {
+    if ((column & 7) != 0) printf("\n");
+    column = 0;
+}
+
+static void close_array(void) {
+    if (binary) {
+	printf("%s %s %d %d\n", array.type, array.name, array.align, array.size);
+	fwrite(array.data, 1, array.size, stdout);
+	return;
+    }
+    break_line();
+    printf("};\n");
+}
+
+static void append_array(void *ptr, int size) {
+    if (array.size + size > array.capacity) {
+	array.capacity = 2 * (array.size + size);
+	array.data = realloc(array.data, array.capacity);
+    }
+    memcpy(array.data + array.size, ptr, size);
+    array.size += size;
+}
+
 static void dump_buffer(void *ptr, int size, int step) {
+    if (binary) {
+	append_array(ptr, size * step);
+	return;
+    }
     for (int i = 0; i < size; i++) {
 	if (step == 1) {
 	    printf(" 0x%02x,", * (unsigned char *) ptr);
@@ -114,36 +251,145 @@ static void dump_buffer(void *ptr, int size, int step) {
 	else {
 	    printf(" 0x%04x,", * (unsigned short *) ptr);
 	}
-	if ((i & 7) == 7) printf("\n");
+	if ((++column & 7) == 0) printf("\n");
 	ptr += step;
     }
-    if ((size & 7) != 0) printf("\n");
 }
 
-static void save_bitmap(struct Header *header, unsigned char *buf, int size) {
-    int j = 0;
-    char name[256];
-    int attribute_size = size / 64;
-    unsigned short on[attribute_size];
-    remove_extension(file_name, name);
-    printf("const byte %s[] = {\n", name);
-    for (int i = 0; i < size; i += 8) {
-	if (i / header->w % 8 == 0) {
-	    on[j++] = on_pixel(buf, i, header->w);
+static void dump_file(FILE *file) {
+    int size;
+    unsigned char buf[4096];
+    rewind(file);
+    while ((size = fread(buf, 1, sizeof(buf), file)) > 0) {
+	dump_buffer(buf, size, 1);
+    }
+}
+
+static unsigned char *load_file(FILE *file, int *size) {
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    rewind(file);
+    unsigned char *buf = malloc(*size + 1);
+    if (fread(buf, 1, *size, file) != *size) {
+	fprintf(stderr, "ERROR: unable to read back %s\n", file_name);
+	exit(-EIO);
+    }
+    return buf;
+}
+
+static int pack_run(unsigned char *buf, int i, int size) {
+    int n = 1;
+    while (i + n < size && n < 64 && buf[i + n] == buf[i]) n++;
+    return n;
+}
+
+static int pack_match(unsigned char *buf, int i, int size, int w, int *up) {
+    int best = 0;
+    for (int rows = 1; rows <= 255 && rows * w <= i; rows++) {
+	int n = 0;
+	int from = i - rows * w;
+	while (i + n < size && n < 128 && buf[from + n] == buf[i + n]) n++;
+	if (n > best) {
+	    best = n;
+	    *up = rows;
 	}
-	unsigned char pixel = on[ink_index(header, i)] & 0xff;
-	printf(" 0x%02x,", consume_pixels(buf + i, pixel));
-	if ((i % 64) == 56) printf("\n");
     }
-    if (has_any_color()) {
-	unsigned char buf[attribute_size];
-	printf(" /* %s attributes */\n", name);
-	for (int i = 0; i < attribute_size; i++) {
-	    buf[i] = encode_ink(on[i]);
+    return best;
+}
+
+/*
+ * Packed stream tokens, decoded by draw_image():
+ *   00nnnnnn         n + 1 literal bytes follow
+ *   01nnnnnn xx      byte xx repeated n + 1 times
+ *   1nnnnnnn rr      n + 1 bytes copied from rr pixel rows above
+ * Matches address rows of the screen being drawn, so they are
+ * never emitted for attributes (w == 0), where zero means skip.
+ * With w == 1 rr is a plain distance back, for the cold overlay.
+ */
+static int pack_buffer(unsigned char *out, unsigned char *buf,
+		       int size, int w) {
+    int n = 0, literal = -1;
+    for (int i = 0; i < size; ) {
+	int up = 0;
+	int run = pack_run(buf, i, size);
+	int match = w > 0 ? pack_match(buf, i, size, w, &up) : 0;
+	if (match > run && match >= 3) {
+	    out[n++] = 0x80 | (match - 1);
+	    out[n++] = up;
+	    literal = -1;
+	    i += match;
+	}
+	else if (run >= 3) {
+	    out[n++] = 0x40 | (run - 1);
+	    out[n++] = buf[i];
+	    literal = -1;
+	    i += run;
+	}
+	else {
+	    if (literal < 0 || out[literal] == 0x3f) {
+		literal = n;
+		out[n++] = 0xff;
+	    }
+	    out[literal]++;
+	    out[n++] = buf[i++];
 	}
-	dump_buffer(buf, attribute_size, 1);
     }
-    printf("};\n");
+    return n;
+}
+
+static void save_image(char *name, FILE *pixels, FILE *ink, int w) {
+    open_array("byte", name, 1);
+    if (pack) {
+	int size, ink_size = 0;
+	unsigned char *buf = load_file(pixels, &size);
+	unsigned char *attributes = ink ? load_file(ink, &ink_size) : NULL;
+	unsigned char *out = malloc(2 * (size + ink_size) + 1);
+	int n = pack_buffer(out, buf, size, w);
+	n += pack_buffer(out + n, attributes, ink_size, 0);
+	fprintf(stderr, "IMAGE:%s SIZE:%d PACKED:%d\n",
+		name, size + ink_size, n);
+	dump_buffer(out, n, 1);
+	free(attributes);
+	free(out);
+	free(buf);
+    }
+    else {
+	dump_file(pixels);
+	if (ink && !binary) {
+	    break_line();
+	    printf(" /* %s attributes */\n", name);
+	}
+	if (ink) {
+	    dump_file(ink);
+	}
+    }
+    close_array();
+    if (ink) fclose(ink);
+    fclose(pixels);
+}
+
+static void save_bitmap(struct Image *image) {
+    char name[256];
+    int w = image->header.w;
+    unsigned char *strip = malloc(8 * w);
+    unsigned char *bitmap = malloc(w);
+    FILE *pixels = tmpfile();
+    FILE *ink = has_any_color() ? tmpfile() : NULL;
+    remove_extension(file_name, name);
+    while (read_strip(image, strip)) {
+	for (int x = 0; x < w; x += 8) {
+	    unsigned short on = on_pixel(strip, x, w);
+	    for (int y = 0; y < 8; y++) {
+		unsigned char *row = strip + y * w + x;
+		bitmap[y * w / 8 + x / 8] = consume_pixels(row, on & 0xff);
+	    }
+	    if (ink) fputc(encode_ink(on), ink);
+	}
+	fwrite(bitmap, 1, w, pixels);
+    }
+    save_image(name, pixels, ink, w / 8);
+    free(bitmap);
+    free(strip);
 }
 
 static unsigned char consume_pixels_cpc(unsigned char *buf) {
@@ -155,55 +401,158 @@ static unsigned char consume_pixels_cpc(unsigned char *buf) {
     return ret;
 }
 
-static void save_bitmap_cpc(struct Header *header, unsigned char *buf) {
+static void save_bitmap_cpc(struct Image *image) {
     char name[256];
-    int size = header->w * header->h;
+    int w = image->header.w;
+    unsigned char *strip = malloc(8 * w);
+    unsigned char *bitmap = malloc(2 * w);
+    FILE *pixels = tmpfile();
     remove_extension(file_name, name);
-    printf("const byte %s[%d] = {\n", name, size / 4);
-    for (int i = 0; i < size; i += 4) {
-	printf(" 0x%02x,", consume_pixels_cpc(buf + i));
-	if ((i % 32) == 28) printf("\n");
+    while (read_strip(image, strip)) {
+	for (int i = 0; i < 8 * w; i += 4) {
+	    bitmap[i / 4] = consume_pixels_cpc(strip + i);
+	}
+	fwrite(bitmap, 1, 2 * w, pixels);
     }
-    printf("};\n");
+    save_image(name, pixels, NULL, w / 4);
+    free(bitmap);
+    free(strip);
 }
 
-static void save_font_cpc(struct Header *header, unsigned char *buf) {
-    int i = 0;
+static void save_font_cpc(struct Image *image) {
     char name[256];
-    int size = header->w * header->h;
+    unsigned char glyph[16];
+    int w = image->header.w;
+    unsigned char *strip = malloc(8 * w);
     remove_extension(file_name, name);
-    printf("const byte %s[%d] = {\n", name, size / 4);
-    for (int row = 0; row < header->h; row += 8) {
-	for (int x = 0; x < header->w; x += 8) {
+    open_array("byte", name, 1);
+    while (read_strip(image, strip)) {
+	for (int x = 0; x < w; x += 8) {
 	    for (int y = 0; y < 8; y++) {
-		int offset = (row + y) * header->w + x;
-		printf(" 0x%02x,", consume_pixels_cpc(buf + offset + 0));
-		printf(" 0x%02x,", consume_pixels_cpc(buf + offset + 4));
-		if ((i++ % 4) == 3) printf("\n");
+		int offset = y * w + x;
+		glyph[2 * y + 0] = consume_pixels_cpc(strip + offset + 0);
+		glyph[2 * y + 1] = consume_pixels_cpc(strip + offset + 4);
 	    }
+	    dump_buffer(glyph, sizeof(glyph), 1);
+	}
+    }
+    close_array();
+    free(strip);
+}
+
+#define TILE_ROW	(target == CPC ? 2 : 1)
+#define TILE_SIZE	(8 * TILE_ROW)
+#define FLIP_H		0x40
+#define FLIP_V		0x80
+
+static unsigned char flip_bits(unsigned char source) {
+    unsigned char result = 0;
+    for (int i = 0; i < 8; i++) {
+	result = result << 1;
+	result |= source & 1;
+	source = source >> 1;
+    }
+    if (target == CPC) {
+	result = (result >> 4) | (result << 4);
+    }
+    return result;
+}
+
+static void flip_tile(unsigned char *dst, unsigned char *src, int flags) {
+    for (int y = 0; y < 8; y++) {
+	int row = (flags & FLIP_V) ? 7 - y : y;
+	for (int x = 0; x < TILE_ROW; x++) {
+	    int col = (flags & FLIP_H) ? TILE_ROW - x - 1 : x;
+	    unsigned char data = src[row * TILE_ROW + col];
+	    dst[y * TILE_ROW + x] = (flags & FLIP_H) ? flip_bits(data) : data;
 	}
     }
-    printf("};\n");
+}
+
+static void read_tile(unsigned char *tile, unsigned char *buf, int i, int w) {
+    unsigned char pixel = target == ZXS ? on_pixel(buf, i, w) & 0xff : 0;
+    for (int y = 0; y < 8; y++) {
+	if (target == ZXS) {
+	    tile[y] = consume_pixels(buf + i, pixel);
+	}
+	else {
+	    tile[2 * y + 0] = consume_pixels_cpc(buf + i + 0);
+	    tile[2 * y + 1] = consume_pixels_cpc(buf + i + 4);
+	}
+	i += w;
+    }
+}
+
+static int find_tile(unsigned char *tiles, int count, unsigned char *tile) {
+    unsigned char flipped[TILE_SIZE];
+    for (int i = 0; i < count; i++) {
+	for (int flags = 0; flags <= (FLIP_H | FLIP_V); flags += FLIP_H) {
+	    flip_tile(flipped, tiles + i * TILE_SIZE, flags);
+	    if (memcmp(flipped, tile, TILE_SIZE) == 0) return i | flags;
+	}
+    }
+    return -1;
+}
+
+static void save_tiles(struct Image *image) {
+    int size = 0, count = 0;
+    char name[256], map[260];
+    int w = image->header.w;
+    unsigned char tiles[(FLIP_H + 1) * TILE_SIZE];
+    unsigned char *strip = malloc(8 * w);
+    unsigned char *entry = malloc(w / 4);
+    remove_extension(file_name, name);
+    sprintf(map, "%s_map", name);
+    open_array("byte", map, 1);
+    while (read_strip(image, strip)) {
+	int n = 0;
+	for (int x = 0; x < w; x += 8) {
+	    unsigned char *tile = tiles + count * TILE_SIZE;
+	    read_tile(tile, strip, x, w);
+	    int index = find_tile(tiles, count, tile);
+	    if (index < 0) index = count++;
+	    if (count > FLIP_H) {
+		fprintf(stderr, "ERROR: %s has too many tiles\n", name);
+		exit(-1);
+	    }
+	    entry[n++] = index;
+	    if (target == ZXS) {
+		entry[n++] = encode_ink(on_pixel(strip, x, w));
+	    }
+	}
+	dump_buffer(entry, n, 1);
+	size += n;
+    }
+    close_array();
+    fprintf(stderr, "TILES:%s CELLS:%d UNIQUE:%d SIZE:%d\n",
+	    name, image->header.w * image->header.h / 64,
+	    count, count * TILE_SIZE + size);
+    strcat(name, "_tiles");
+    open_array("byte", name, 1);
+    dump_buffer(tiles, count * TILE_SIZE, 1);
+    close_array();
+    free(entry);
+    free(strip);
 }
 
 static unsigned short pixel_addr(int x, int y) {
-#ifdef ZXS
-    int f = ((y & 7) << 3) | ((y >> 3) & 7) | (y & 0xc0);
-    return 0x4000 + (f << 5) + (x >> 3);
-#endif
-#ifdef CPC
-    int f = ((y & 7) << 11) | (80 * (y >> 3));
-    return 0xC000 + f + (x >> 2);
-#endif
+    if (target == ZXS) {
+	int f = ((y & 7) << 3) | ((y >> 3) & 7) | (y & 0xc0);
+	return 0x4000 + (f << 5) + (x >> 3);
+    }
+    else {
+	int f = ((y & 7) << 11) | (80 * (y >> 3));
+	return 0xC000 + f + (x >> 2);
+    }
 }
 
 static unsigned char pixel_data(int x) {
-#ifdef ZXS
-    return (1 << (7 - (x & 7)));
-#endif
-#ifdef CPC
-    return (1 << (3 - (x & 3)));
-#endif
+    if (target == ZXS) {
+	return (1 << (7 - (x & 7)));
+    }
+    else {
+	return (1 << (3 - (x & 3)));
+    }
 }
 
 unsigned char line_data[0x10000];
@@ -221,63 +570,157 @@ static void save_lines(void) {
 	    size++;
 	}
     }
-    printf("const word line_addr[] = {\n");
+    open_array("word", "line_addr", 256);
     dump_buffer(line_addr, size, 2);
-    printf("};\n");
-    printf("const byte line_data[] = {\n");
+    close_array();
+    open_array("byte", "line_data", 256);
     dump_buffer(line_data, size, 1);
-    printf("};\n");
+    close_array();
+
+    /* a pair ray in a shared cell takes one write, see save_diff() */
+    int shared = 0;
+    for (int i = 0; i < size; i++) {
+	if (line_addr[i] == line_addr[(i + 32) % size]) shared++;
+    }
+    fprintf(stderr, "JOIN:%s CELLS:%d SHARED:%d\n",
+	    targets[target], size, shared);
 }
 
-unsigned char unfold[128][512];
-unsigned char level[sizeof(unfold)];
+typedef unsigned long long row_t __attribute__((vector_size(16)));
 
-static int get_diff(unsigned char *diff, unsigned y, int height) {
-    int i, n = 0;
-    y = y % height;
-    for (int x = 0; x < 128; x++) {
-	i = (y + height - 1) % height;
-	if (unfold[x][y] != unfold[x][i]) diff[n++] = x;
+/* level canvas, one 128-bit row per step, grown on demand */
+struct Canvas {
+    int height;
+    row_t *rows;
+};
+
+/* one generated level, compiled on a worker and emitted in order */
+struct Level {
+    char *name;
+    int (*fill)(struct Canvas *c);
+    int align;
+    int repeat;
+    struct Canvas canvas;
+    unsigned char *data;
+    int size;
+    int pairs;
+};
+
+static row_t canvas_row(struct Canvas *c, unsigned y) {
+    row_t empty = { 0, 0 };
+    return y < c->height ? c->rows[y] : empty;
+}
+
+static row_t *canvas_grow(struct Canvas *c, int y) {
+    if (y >= c->height) {
+	int height = 2 * y + 64;
+	c->rows = realloc(c->rows, height * sizeof(row_t));
+	memset(c->rows + c->height, 0,
+	       (height - c->height) * sizeof(row_t));
+	c->height = height;
     }
-    return n;
+    return c->rows + y;
 }
 
-static int get_line(unsigned char *diff, int y) {
+static void plot(struct Canvas *c, int x, int y, int on) {
+    if (x < 0 || x >= 128 || y < 0) return;
+    row_t *row = canvas_grow(c, y);
+    unsigned long long bit = 1ULL << (x & 63);
+    if (on) {
+	(*row)[x >> 6] |= bit;
+    }
+    else {
+	(*row)[x >> 6] &= ~bit;
+    }
+}
+
+#ifdef DEBUG
+static int pixel(struct Canvas *c, int x, int y) {
+    return (canvas_row(c, y)[x >> 6] >> (x & 63)) & 1;
+}
+#endif
+
+static void clear_canvas(struct Canvas *c) {
+    free(c->rows);
+    c->rows = NULL;
+    c->height = 0;
+}
+
+static int get_bits(unsigned char *diff, row_t row) {
     int n = 0;
-    for (int x = 0; x < 128; x++) {
-	if (unfold[x][y]) diff[n++] = x;
+    for (int i = 0; i < 2; i++) {
+	unsigned long long bits = row[i];
+	while (bits) {
+	    diff[n++] = 64 * i + __builtin_ctzll(bits);
+	    bits &= bits - 1;
+	}
     }
     return n;
 }
 
-static void save_diff(unsigned char *diff, int amount, int *index, int wait) {
+static int get_diff(struct Canvas *c, unsigned char *diff,
+		    unsigned y, int height) {
+    y = y % height;
+    row_t row = canvas_row(c, y) ^ canvas_row(c, (y + height - 1) % height);
+    return get_bits(diff, row);
+}
+
+static int get_line(struct Canvas *c, unsigned char *diff, int y) {
+    return get_bits(diff, canvas_row(c, y));
+}
+
+/*
+ * Columns c and c + 1 of one row go out as the single entry c | PAIR,
+ * they step out together so draw_field() draws them as one ray and
+ * with one read-modify-write where both land in the same screen byte.
+ * The pair test costs draw_field() about 15T on every ray and a pair
+ * saves about 115T, so levels with fewer than one pair in PAIR_WORTH
+ * rays go out unpaired. Returns the number of pairs.
+ */
+#define PAIR		0x80
+#define PAIRED		0x80
+#define PAIR_WORTH	8
+
+static int save_diff(unsigned char *level, unsigned char *diff,
+		     int amount, int *index, int wait, int pair) {
+    int pairs = 0;
     if (wait >= 0) {
 	level[(*index)++] = wait;
     }
-    level[(*index)++] = amount;
+    int count = (*index)++;
     for (int i = 0; i < amount; i++) {
-	level[(*index)++] = diff[i];
+	if (pair && i + 1 < amount && diff[i + 1] == diff[i] + 1) {
+	    level[(*index)++] = diff[i++] | PAIR;
+	    pairs++;
+	}
+	else {
+	    level[(*index)++] = diff[i];
+	}
     }
+    level[count] = amount - pairs;
+    return pairs;
 }
 
-static int serialize(int height) {
+/* returns the number of rays, a pair counts once */
+static int save_rows(struct Level *l, int height, int pair) {
     int amount;
     int wait = 1;
     int index = 0;
+    int rays = 0;
     unsigned char diff[128];
-#ifdef DEBUG
-    for (int y = 0; y < height; y++) {
-	for (int x = 0; x < 128; x++) {
-	    fprintf(stderr, "%d", unfold[x][y]);
-	}
-	fprintf(stderr, "\n");
-    }
-#endif
-    save_diff(diff, get_line(diff, 0), &index, -1);
+    struct Canvas *c = &l->canvas;
+    unsigned char *level = malloc(2 * 130 * (height + 2));
+    amount = get_line(c, diff, 0);
+    l->pairs = save_diff(level, diff, amount, &index, -1, pair);
+    rays += amount;
     for (int y = 1; y <= height; y++) {
-	amount = get_diff(diff, y, height);
+	amount = get_diff(c, diff, y, height);
 	if (amount > 0) {
-	    save_diff(diff, amount, &index, wait);
+	    for (; wait > 255; wait -= 255) {
+		save_diff(level, diff, 0, &index, 255, pair);
+	    }
+	    l->pairs += save_diff(level, diff, amount, &index, wait, pair);
+	    rays += amount;
 	    wait = 1;
 	}
 	else {
@@ -285,161 +728,426 @@ static int serialize(int height) {
 	}
     }
     level[index++] = 0;
-    return index;
+    l->data = level;
+    l->size = index;
+    return rays - l->pairs;
 }
 
-static void save_buffer(char *name, int (*fill)(void)) {
-    memset(unfold, 0, sizeof(unfold));
-    int size = serialize(fill());
-    fprintf(stderr, "LEVEL:%s SIZE:%d\n", name, size);
-    printf("const byte %s[] = {\n", name);
-    dump_buffer(level, size, 1);
-    printf("};\n");
+static void serialize(struct Level *l) {
+    int height = l->fill(&l->canvas);
+    int rays = save_rows(l, height, 1);
+    if (l->pairs * PAIR_WORTH < rays) {
+	free(l->data);
+	save_rows(l, height, 0);
+    }
 }
 
-static unsigned char squiggly_interval(int x, int n) {
-    return  (4 + n < x && x <  8 + n)
-	|| (46 + n < x && x < 50 + n)
-	|| (88 + n < x && x < 92 + n);
+/*
+ * Keyframes replay the stream the way emit_generated and draw_field do
+ * and snapshot the state after the emit of every n-th frame:
+ *   frame.w offset.w wait repeat columns[16] rays [ray.w] * rays
+ * columns has a bit for every column whose finished rays are odd, so
+ * its whole line is on, a pair finishes two columns. The array starts
+ * with the repeat count, or'ed with PAIRED when the stream has pairs,
+ * and only when keyframes are asked for, the number of keyframes.
+ */
+#define KEY_SIZE	23
+
+static void save_keys(struct Level *l, int every) {
+    unsigned short ray[256];
+    unsigned char head = 0, tail = 0, columns[16] = { 0 };
+    unsigned char *data = l->data, *keys = NULL;
+    int size = every > 0 ? 2 : 1, count = 0, frame = 0;
+    int repeat = l->repeat, current = 0, wrap, wait;
+
+    for (int i = data[current++]; i > 0; i--) {
+	ray[head++] = data[current++] << 5;
+    }
+    wrap = current;
+    wait = data[current++];
+    while (wait != 0) {
+	if (every > 0 && frame > 0 && frame % every == 0) {
+	    unsigned char rays = head - tail;
+	    keys = realloc(keys, size + KEY_SIZE + 2 * rays);
+	    unsigned char *key = keys + size;
+	    key[0] = frame & 0xff;
+	    key[1] = frame >> 8;
+	    key[2] = current & 0xff;
+	    key[3] = current >> 8;
+	    key[4] = wait;
+	    key[5] = repeat;
+	    memcpy(key + 6, columns, sizeof(columns));
+	    key[22] = rays;
+	    for (unsigned char i = 0; i < rays; i++) {
+		unsigned short r = ray[(unsigned char) (tail + i)];
+		key[KEY_SIZE + 2 * i] = r & 0xff;
+		key[KEY_SIZE + 2 * i + 1] = r >> 8;
+	    }
+	    size += KEY_SIZE + 2 * rays;
+	    count++;
+	}
+	for (unsigned char i = tail; i != head; i++) {
+	    unsigned short r = ray[i]++;
+	    if ((r & 0x1f) == 0x1f) {
+		int column = (r >> 5) & 0x7f, last = column + (r >> 12);
+		for (; column <= last; column++) {
+		    columns[column >> 3] ^= 1 << (column & 7);
+		}
+		tail++;
+	    }
+	}
+	frame++;
+	if (--wait == 0) {
+	    for (int i = data[current++]; i > 0; i--) {
+		ray[head++] = data[current++] << 5;
+	    }
+	    wait = data[current++];
+	    if (wait == 0 && repeat > 1) {
+		repeat--;
+		current = wrap;
+		wait = data[current++];
+	    }
+	}
+    }
+    keys = realloc(keys, size);
+    keys[0] = l->repeat | (l->pairs ? PAIRED : 0);
+    if (every > 0) keys[1] = count;
+
+    char name[64];
+    sprintf(name, "%s_keys", l->name);
+    fprintf(stderr, "KEYS:%s FRAMES:%d COUNT:%d SIZE:%d\n",
+	    l->name, frame, count, size);
+    open_array("byte", name, 1);
+    dump_buffer(keys, size, 1);
+    close_array();
+    free(keys);
 }
 
-static int squiggly(void) {
-    for (int y = 0; y < 32; y++) {
+static void save_level(struct Level *l, int every) {
+#ifdef DEBUG
+    for (int y = 0; y < l->canvas.height; y++) {
 	for (int x = 0; x < 128; x++) {
-	    int offset = roundf(4.0 * sin(2 * M_PI * y / 32.0));
-	    unfold[x][y] = squiggly_interval(x, offset);
+	    fprintf(stderr, "%d", pixel(&l->canvas, x, y));
+	}
+	fprintf(stderr, "\n");
+    }
+#endif
+    fprintf(stderr, "LEVEL:%s SIZE:%d PAIRS:%d\n",
+	    l->name, l->size, l->pairs);
+    open_array("byte", l->name, l->align);
+    dump_buffer(l->data, l->size, 1);
+    close_array();
+    save_keys(l, every);
+    clear_canvas(&l->canvas);
+    free(l->data);
+}
+
+/* integer rasterizer: the canvas wraps at 128 columns */
+
+static unsigned long long lane_mask(int from, int to, int lane) {
+    int lo = from > 64 * lane ? from - 64 * lane : 0;
+    int hi = to < 64 * lane + 64 ? to - 64 * lane : 64;
+    if (lo >= hi) return 0;
+    unsigned long long bits = hi - lo == 64 ? ~0ULL : (1ULL << (hi - lo)) - 1;
+    return bits << lo;
+}
+
+static void fill_row(struct Canvas *c, int y, int from, int to) {
+    row_t *row = canvas_grow(c, y);
+    (*row)[0] |= lane_mask(from, to, 0);
+    (*row)[1] |= lane_mask(from, to, 1);
+}
+
+/* pixels x1 <= x < x2 of row y */
+static void span(struct Canvas *c, int y, int x1, int x2) {
+    if (y < 0 || x2 <= x1) return;
+    if (x2 - x1 >= 128) {
+	fill_row(c, y, 0, 128);
+	return;
+    }
+    int from = ((x1 % 128) + 128) % 128;
+    int to = from + (x2 - x1);
+    fill_row(c, y, from, to < 128 ? to : 128);
+    if (to > 128) fill_row(c, y, 0, to - 128);
+}
+
+static void vspan(struct Canvas *c, int x, int y, int length) {
+    for (int i = 0; i < length; i++) {
+	plot(c, x, y + i, 1);
+    }
+}
+
+static int isqrt(long long n) {
+    long long r = 0, bit = 1LL << 62;
+    while (bit > n) bit >>= 2;
+    while (bit) {
+	if (n >= r + bit) {
+	    n -= r + bit;
+	    r = (r >> 1) + bit;
+	}
+	else {
+	    r >>= 1;
+	}
+	bit >>= 2;
+    }
+    return r;
+}
+
+/* s * sqrt(d) <= a */
+static int below(long long s, long long a, long long d) {
+    if (s <= 0) return a >= 0 || s * s * d >= a * a;
+    return a > 0 && s * s * d <= a * a;
+}
+
+/* samples every half pixel along the line and rounds each coordinate
+ * half up, the way the old float walk did, but in exact arithmetic */
+static void line(struct Canvas *c, int x1, int y1, int x2, int y2) {
+    long long dx = x2 - x1, dy = y2 - y1, d = dx * dx + dy * dy;
+    if (d == 0) return;
+    int steps = isqrt(4 * d);
+    int mx = 0, my = 0;
+    for (int k = 0; k <= steps; k++) {
+	while (!below(2 * mx - 1, dx * k, d)) mx--;
+	while (below(2 * mx + 1, dx * k, d)) mx++;
+	while (!below(2 * my - 1, dy * k, d)) my--;
+	while (below(2 * my + 1, dy * k, d)) my++;
+	plot(c, ((x1 + mx) % 128 + 128) % 128, y1 + my, 1);
+    }
+}
+
+/* even-odd fill of the pixel centers inside a closed outline */
+static void polygon(struct Canvas *c, const int *xy, int count) {
+    int top = xy[1], bottom = xy[1];
+    for (int i = 1; i < count; i++) {
+	if (xy[2 * i + 1] < top) top = xy[2 * i + 1];
+	if (xy[2 * i + 1] > bottom) bottom = xy[2 * i + 1];
+    }
+    int cross[count];
+    for (int y = top; y < bottom; y++) {
+	int n = 0;
+	for (int i = 0; i < count; i++) {
+	    const int *p = xy + 2 * i;
+	    const int *q = xy + 2 * ((i + 1) % count);
+	    if ((p[1] <= y) == (q[1] <= y)) continue;
+	    long long num = (long long) (y - p[1]) * (q[0] - p[0]);
+	    long long den = q[1] - p[1];
+	    if (den < 0) num = -num, den = -den;
+	    long long x = num >= 0 ? (num + den - 1) / den : -(-num / den);
+	    int at = p[0] + x;
+	    int j = n++;
+	    while (j > 0 && cross[j - 1] > at) {
+		cross[j] = cross[j - 1];
+		j--;
+	    }
+	    cross[j] = at;
+	}
+	for (int i = 0; i + 1 < n; i += 2) {
+	    span(c, y, cross[i], cross[i + 1]);
+	}
+    }
+}
+
+static long long turn(const int *o, const int *a, const int *b) {
+    return (long long) (a[0] - o[0]) * (b[1] - o[1])
+	- (long long) (a[1] - o[1]) * (b[0] - o[0]);
+}
+
+/* convex hull of count points, in place, returns its size */
+static int hull(int *xy, int count) {
+    int point[2 * count + 2], n = 0;
+    for (int i = 1; i < count; i++) {
+	int x = xy[2 * i], y = xy[2 * i + 1], j = i;
+	for (; j > 0 && (xy[2 * j - 2] > x
+			 || (xy[2 * j - 2] == x && xy[2 * j - 1] > y)); j--) {
+	    xy[2 * j] = xy[2 * j - 2];
+	    xy[2 * j + 1] = xy[2 * j - 1];
+	}
+	xy[2 * j] = x;
+	xy[2 * j + 1] = y;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+	int start = n;
+	for (int k = 0; k < count; k++) {
+	    const int *p = xy + 2 * (pass ? count - 1 - k : k);
+	    while (n >= start + 2
+		   && turn(point + 2 * n - 4, point + 2 * n - 2, p) <= 0) n--;
+	    point[2 * n] = p[0];
+	    point[2 * n + 1] = p[1];
+	    n++;
+	}
+	n--;
+    }
+    memcpy(xy, point, 2 * n * sizeof(int));
+    return n;
+}
+
+/* corners of the square brush of radius r around x, y */
+static int brush(int *xy, int x, int y, int r) {
+    for (int i = 0; i < 4; i++) {
+	xy[2 * i] = x + (i & 1 ? r : -r);
+	xy[2 * i + 1] = y + (i & 2 ? r : -r);
+    }
+    return 4;
+}
+
+/* square brush of radius r swept from one end to the other: the hull
+ * of both squares filled, the far edges the fill leaves open drawn */
+static void thick_line(struct Canvas *c,
+		       int x1, int y1, int x2, int y2, int r) {
+    int xy[16];
+    brush(xy, x1, y1, r);
+    brush(xy + 8, x2, y2, r);
+    int n = hull(xy, 8);
+    polygon(c, xy, n);
+    for (int i = 0; i < n; i++) {
+	int j = (i + 1) % n;
+	line(c, xy[2 * i], xy[2 * i + 1], xy[2 * j], xy[2 * j + 1]);
+    }
+}
+
+/* brush of radius r at the base narrowing to a point at the tip: the
+ * hull of the square and the tip filled, the square drawn in spans and
+ * the lines from its corners to the tip, which keep the tip's rounding */
+static void taper(struct Canvas *c, int x1, int y1, int x2, int y2, int r) {
+    int xy[10];
+    brush(xy, x1, y1, r);
+    for (int i = 0; i < 4; i++) {
+	line(c, xy[2 * i], xy[2 * i + 1], x2, y2);
+    }
+    for (int b = -r; b <= r; b++) {
+	span(c, y1 + b, x1 - r, x1 + r + 1);
+    }
+    xy[8] = x2;
+    xy[9] = y2;
+    polygon(c, xy, hull(xy, 5));
+}
+
+static void ellipse(struct Canvas *c, int x, int y, int r1, int r2) {
+    long long a = 2 * r1 + 1, b = 2 * r2 + 1;
+    for (int dy = -r2; dy <= r2; dy++) {
+	long long room = a * a * (b * b - 4 * dy * dy);
+	int dx = isqrt(room / (4 * b * b));
+	span(c, y + dy, x - dx, x + dx + 1);
+    }
+}
+
+/* bilinear upscale of a w * h glyph of 0/1 cells, pixel set above half */
+static void blit(struct Canvas *c, const int *glyph,
+		 int w, int h, int x, int y, int scale) {
+    int s = scale - 1;
+    for (int dy = 0; dy < h - 1; dy++) {
+	for (int dx = 0; dx < w - 1; dx++) {
+	    const int *p = glyph + dy * w + dx;
+	    for (int sy = 0; sy < scale; sy++) {
+		for (int sx = 0; sx < scale; sx++) {
+		    int a = p[0] * (s - sx) + p[1] * sx;
+		    int b = p[w] * (s - sx) + p[w + 1] * sx;
+		    int v = a * (s - sy) + b * sy;
+		    plot(c, x + dx * scale + sx, y + dy * scale + sy, 2 * v > s * s);
+		}
+	    }
 	}
     }
+}
+
+static int squiggly(struct Canvas *c) {
+    for (int y = 0; y < 32; y++) {
+	int n = roundf(4.0 * sin(2 * M_PI * y / 32.0));
+	span(c, y,  5 + n,  8 + n);
+	span(c, y, 47 + n, 50 + n);
+	span(c, y, 89 + n, 92 + n);
+    }
     return 32;
 }
 
-static int diamonds(void) {
+static int diamonds(struct Canvas *c) {
     float q = 10.0;
     for (unsigned y = 1; y < 251; y += 5) {
 	unsigned x = roundf(q);
 	for (unsigned i = 0; i < 3; i++) {
 	    int n = x - 1 + i;
-	    unfold[x % 128][y + i] = 1;
-	    unfold[n % 128][y + 1] = 1;
+	    plot(c, x % 128, y + i, 1);
+	    plot(c, n % 128, y + 1, 1);
 	}
 	q += 128.0 * GOLDEN;
     }
     return 255;
 }
 
-static int rings(void) {
+static int rings(struct Canvas *c) {
     float q = 1.0;
     for (unsigned x = 0; x < 32; x += 2) {
 	for (unsigned y = 30; y < 32; y++) {
-	    unfold[x +  0][y] = 1;
-	    unfold[x + 64][y] = 1;
+	    plot(c, x +  0, y, 1);
+	    plot(c, x + 64, y, 1);
 	}
 	for (unsigned y = 62; y < 64; y++) {
-	    unfold[x + 32][y] = 1;
-	    unfold[x + 96][y] = 1;
+	    plot(c, x + 32, y, 1);
+	    plot(c, x + 96, y, 1);
 	}
     }
     return 64;
 }
 
-static void gamma_ray(int x, int y, int size) {
-    for (unsigned i = 0; i < size; i++) {
-	unfold[x][y + i] = 1;
-    }
+static void gamma_ray(struct Canvas *c, int x, int y, int size) {
+    vspan(c, x, y, size);
 }
 
-static int gamma_rain(void) {
+static int gamma_rain(struct Canvas *c) {
     int offset = 0;
     for (unsigned y = 0; y < 32; y += 16) {
 	for (unsigned x = 0; x < 128; x += 32) {
-	    gamma_ray((x + offset + 8) % 128, y + 1, 8);
+	    gamma_ray(c, (x + offset + 8) % 128, y + 1, 8);
 	}
 	offset = 16 - offset;
     }
     return 32;
 }
 
-static int curve(void) {
-    int offset = 0;
-    for (unsigned y = 0; y < 128; y++) {
-	for (unsigned x = 0; x < 128; x++) {
-	    float q = 16.0 * sin(2 * M_PI * y / 64.0);
-	    unfold[x][y] = roundf(40.0 - q) < x && x < roundf(88.0 + q);
-	}
-	unsigned char buf[128];
-	for (unsigned x = 0; x < 128; x++) {
-	    buf[x] = unfold[(x + y) % 128][y];
-	}
-	for (unsigned x = 0; x < 128; x++) {
-	    unfold[x][y] = buf[x];
-	}
+static int curve(struct Canvas *c) {
+    for (int y = 0; y < 128; y++) {
+	float q = 16.0 * sin(2 * M_PI * y / 64.0);
+	int left = roundf(40.0 - q);
+	int right = roundf(88.0 + q);
+	span(c, y, left + 1 - y, right - y);
     }
     return 128;
 }
 
-static int twinkle_lines(int center, int offset, int y) {
-    for (int i = center - offset; i < center + offset; i++) {
-	unfold[i % 128][y] = 1;
-    }
-}
-
-static void line(int x1, int y1, int x2, int y2) {
-    float dx = (x2 - x1);
-    float dy = (y2 - y1);
-    float len = sqrtf(dx * dx + dy * dy);
-    if (len > 0.0) {
-	dx = dx / len;
-	dy = dy / len;
-	for (float i = 0; i <= len; i += 0.5) {
-	    int px = roundf(x1 + dx * i);
-	    int py = roundf(y1 + dy * i);
-	    unfold[(px + 128) % 128][(py + 512) % 512] = 1;
-	}
-    }
+static void twinkle_lines(struct Canvas *c, int center, int offset, int y) {
+    span(c, y, center - offset, center + offset);
 }
 
-static void circle(int x, int y, int r1, int r2) {
-    for (float i = 0; i <= 2 * M_PI; i += 0.01) {
-	int dx = roundf((float) r1 * sin(i));
-	int dy = roundf((float) r2 * cos(i));
-	line(x, y, x + dx, y + dy);
-    }
-}
-
-static void little_star(int x, int y) {
+static void little_star(struct Canvas *c, int x, int y) {
     for (int i = 0; i < 5; i++) {
 	float angle = 2 * M_PI * i / 5.0  + M_PI / 2;
-	float dx = roundf(6 * sin(angle));
-	float dy = roundf(6 * cos(angle));
-	for (int a = -1; a <= 1; a++) {
-	    for (int b = -1; b <= 1; b++) {
-		line(x + a, y + b, x + dx, y + dy);
-	    }
-	}
+	int dx = roundf(6 * sin(angle));
+	int dy = roundf(6 * cos(angle));
+	taper(c, x, y, x + dx, y + dy, 1);
     }
 }
 
-static int twinkle(void) {
+static int twinkle(struct Canvas *c) {
     int offset = 0;
     const int size = 32;
     for (unsigned y = 0; y < 3 * size; y++) {
 	if (y < size) {
-	    twinkle_lines(size, y, y + 1);
+	    twinkle_lines(c, size, y, y + 1);
 	}
 	else if (y < 2 * size) {
-	    twinkle_lines(size, 2 * size - y - 1, y + 1);
-	    twinkle_lines(128 - size, y - size, y + 1);
+	    twinkle_lines(c, size, 2 * size - y - 1, y + 1);
+	    twinkle_lines(c, 128 - size, y - size, y + 1);
 	}
 	else if (y < 3 * size) {
-	    twinkle_lines(128 - size, 3 * size - y - 1, y + 1);
+	    twinkle_lines(c, 128 - size, 3 * size - y - 1, y + 1);
 	}
     }
-    little_star(32 + 16, 80);
-    little_star(96 + 16, 16);
+    little_star(c, 32 + 16, 80);
+    little_star(c, 96 + 16, 16);
     return 3 * size + 2;
 }
 
-static int four[64] = {
+static const int four[64] = {
     0,0,0,1,1,1,0,0,
     0,0,1,1,1,1,0,0,
     0,1,1,0,1,1,0,0,
@@ -450,7 +1158,7 @@ static int four[64] = {
     0,0,0,0,0,0,0,0,
 };
 
-static int two[64] = {
+static const int two[64] = {
     0,1,1,1,1,1,0,0,
     1,1,0,0,0,1,1,0,
     0,0,0,0,1,1,1,0,
@@ -461,10 +1169,6 @@ static int two[64] = {
     0,0,0,0,0,0,0,0,
 };
 
-static float interpolate(float a, float b, float q) {
-    return a * q + b * (1.0 - q);
-}
-
 static void rotate_ccw(int *ptr, int w, int h) {
     int tmp[w * h];
     for (int y = 0; y < h; y++) {
@@ -487,163 +1191,804 @@ static void flip_horizontal(int *ptr, int w, int h) {
     }
 }
 
-static void scale(int *buf, int x, int y, int w, int h, int scale) {
-    for (int dy = 0; dy < h - 1; dy++) {
-	for (int dx = 0; dx < w - 1; dx++) {
-	    int p1 = buf[(dy + 0) * w + (dx + 0)];
-	    int p2 = buf[(dy + 0) * w + (dx + 1)];
-	    int p3 = buf[(dy + 1) * w + (dx + 0)];
-	    int p4 = buf[(dy + 1) * w + (dx + 1)];
-	    for (int sy = 0; sy < scale; sy++) {
-		for (int sx = 0; sx < scale; sx++) {
-		    int fx = x + dx * scale + sx;
-		    int fy = y + dy * scale + sy;
-		    float qx = (float) sx / (float) (scale - 1);
-		    float qy = (float) sy / (float) (scale - 1);
-		    float a = interpolate(p1, p2, 1.0 - qx);
-		    float b = interpolate(p3, p4, 1.0 - qx);
-		    unfold[fx][fy] = interpolate(a, b, (1.0 - qy)) > 0.5;
-		}
-	    }
-	}
-    }
-}
-
-static int number(void) {
-    flip_horizontal(four, 8, 8);
-    rotate_ccw(four, 8, 8);
-    scale(four, 80, 1, 8, 8, 4);
+static int number(struct Canvas *c) {
+    int glyph[64];
+    memcpy(glyph, four, sizeof(glyph));
+    flip_horizontal(glyph, 8, 8);
+    rotate_ccw(glyph, 8, 8);
+    blit(c, glyph, 8, 8, 80, 1, 4);
 
-    rotate_ccw(two, 8, 8);
-    flip_horizontal(two, 8, 8);
-    scale(two,  16, 1, 8, 8, 4);
+    memcpy(glyph, two, sizeof(glyph));
+    rotate_ccw(glyph, 8, 8);
+    flip_horizontal(glyph, 8, 8);
+    blit(c, glyph, 8, 8, 16, 1, 4);
     return 40;
 }
 
-static int bubbles(void) {
+static int bubbles(struct Canvas *c) {
     float q = 0.0;
     const int size = 8;
     for (unsigned y = size + 1; y < size * 20; y += (size + 1)) {
 	q += 128.0 * GOLDEN;
 	unsigned x = roundf(q);
-	circle(x, y, 6, 8);
+	ellipse(c, x, y, 6, 8);
     }
     return 21 * size;
 }
 
-static int interval(int x, int y, int b1, int b2) {
-    float q1 = 8.0 * sin(2.0 * M_PI * y / 64.0);
-    float q2 = 8.0 * cos(2.0 * M_PI * y / 64.0);
-    return (roundf(b1 - q1) < x && x < roundf(b2 + q2));
+static void interval(struct Canvas *c,
+		     int y, int z, int b1, int b2, int shift) {
+    float q1 = 8.0 * sin(2.0 * M_PI * z / 64.0);
+    float q2 = 8.0 * cos(2.0 * M_PI * z / 64.0);
+    int left = roundf(b1 - q1);
+    int right = roundf(b2 + q2);
+    span(c, y, left + 1 - shift, right - shift);
 }
 
-static int solaris(void) {
-    int offset = 0;
-    for (unsigned y = 0; y < 128; y++) {
-	for (unsigned x = 0; x < 128; x++) {
-	    int z = (y + 32) % 128;
-	    unfold[x][y] = interval(x, y, 24, 40)
-			|| interval(x, z, 88, 104);
-	}
-	unsigned char buf[128];
-	for (unsigned x = 0; x < 128; x++) {
-	    int offset = 32.0 * sin(M_PI * (y / 128.0));
-	    buf[x] = unfold[(x + offset) % 128][y];
-	}
-	for (unsigned x = 0; x < 128; x++) {
-	    unfold[x][y] = buf[x];
-	}
+static int solaris(struct Canvas *c) {
+    for (int y = 0; y < 128; y++) {
+	int offset = 32.0 * sin(M_PI * (y / 128.0));
+	interval(c, y, y, 24, 40, offset);
+	interval(c, y, (y + 32) % 128, 88, 104, offset);
     }
     return 128;
 }
 
-int radiate(void) {
-    srand(42);
+/* glibc random() TYPE_3, so seeded levels come out as they did with rand() */
+struct Random {
+    unsigned state[34];
+    int index;
+};
+
+static int next_random(struct Random *r) {
+    unsigned *s = r->state;
+    int i = r->index;
+    s[i] = s[(i + 3) % 34] + s[(i + 31) % 34];
+    r->index = (i + 1) % 34;
+    return s[i] >> 1;
+}
+
+static void seed_random(struct Random *r, int seed) {
+    r->state[0] = seed ? seed : 1;
+    for (int i = 1; i < 31; i++) {
+	long long word = 16807LL * (int) r->state[i - 1] % 2147483647;
+	r->state[i] = word < 0 ? word + 2147483647 : word;
+    }
+    for (int i = 31; i < 34; i++) {
+	r->state[i] = r->state[i - 31];
+    }
+    r->index = 0;
+    for (int i = 0; i < 310; i++) {
+	next_random(r);
+    }
+}
+
+static int radiate(struct Canvas *c) {
+    struct Random r;
+    seed_random(&r, 42);
     int x = 0, dir = 1;
     for (unsigned y = 0; y < 256; y += 4) {
 	x += 4 * dir;
 	if (x <= 0) dir = 1;
 	if (x >= 128) dir = -1;
 	for (int offset = 0; offset <= 64; offset += 64) {
-	    int n = x + offset + (rand() % 5) - 2;
-	    gamma_ray(n % 128, y + rand() % 16, 4 + rand() % 12);
+	    int n = x + offset + (next_random(&r) % 5) - 2;
+	    int size = 4 + next_random(&r) % 12;
+	    gamma_ray(c, n % 128, y + next_random(&r) % 16, size);
 	}
     }
     return 256;
 }
 
-static void save_game(void) {
-    save_buffer("squiggly", &squiggly);
-    save_buffer("diamonds", &diamonds);
-    save_buffer("rings", &rings);
-    save_buffer("gamma", &gamma_rain);
-    save_buffer("curve", &curve);
-    save_buffer("twinkle", &twinkle);
-    save_buffer("number", &number);
-    save_buffer("bubbles", &bubbles);
-    save_buffer("solaris", &solaris);
-    save_buffer("radiate", &radiate);
+/* name, canvas, alignment and how many times the stream plays */
+static struct Level game[] = {
+    { "squiggly", &squiggly, 256, 8 },
+    { "diamonds", &diamonds, 1, 1 },
+    { "rings", &rings, 1, 7 },
+    { "gamma", &gamma_rain, 1, 8 },
+    { "curve", &curve, 1, 2 },
+    { "twinkle", &twinkle, 1, 3 },
+    { "number", &number, 1, 1 },
+    { "bubbles", &bubbles, 1, 1 },
+    { "solaris", &solaris, 1, 2 },
+    { "radiate", &radiate, 1, 2 },
+};
+
+struct Pool {
+    struct Level *levels;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+};
+
+static void *level_worker(void *arg) {
+    struct Pool *pool = arg;
+    for (;;) {
+	pthread_mutex_lock(&pool->lock);
+	int i = pool->next++;
+	pthread_mutex_unlock(&pool->lock);
+	if (i >= pool->count) return NULL;
+	serialize(pool->levels + i);
+    }
 }
 
-int main(int argc, char **argv) {
-    if (argc < 2) {
-	printf("USAGE: tga-dump [option] file.tga\n");
-	printf("  -b   save bitmap zx\n");
-	printf("  -f   save font cpc\n");
-	printf("  -l   save line data\n");
-	printf("  -g   save game data\n");
-	return 0;
+static void compile_levels(struct Level *levels, int count) {
+    struct Pool pool = { levels, count, 0, PTHREAD_MUTEX_INITIALIZER };
+    int workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers > count) workers = count;
+    if (workers < 1) workers = 1;
+    pthread_t threads[workers];
+    for (int i = 0; i < workers; i++) {
+	pthread_create(threads + i, NULL, &level_worker, &pool);
+    }
+    for (int i = 0; i < workers; i++) {
+	pthread_join(threads[i], NULL);
+    }
+}
+
+static void save_game(int every) {
+    int count = sizeof(game) / sizeof(*game);
+    compile_levels(game, count);
+    for (int i = 0; i < count; i++) {
+	save_level(game + i, every);
     }
+}
 
-    switch (argv[1][1]) {
+/* text file as one NUL terminated string, lines split by '\n' */
+static int save_text(char *file) {
+    char name[256];
+    FILE *in = fopen(file, "r");
+    if (in == NULL) return -ENOENT;
+    remove_extension(file, name);
+    open_array("byte", name, 1);
+    dump_file(in);
+    dump_buffer("", 1, 1);
+    close_array();
+    fprintf(stderr, "TEXT:%s SIZE:%ld\n", name, ftell(in) + 1);
+    fclose(in);
+    return 0;
+}
+
+static int convert(int argc, char **argv) {
+    switch (argv[0][1]) {
     case 'l':
 	save_lines();
 	return 0;
     case 'g':
-	save_game();
+	save_game(argc > 1 ? atoi(argv[1]) : 0);
 	return 0;
+    case 's':
+	return argc > 1 ? save_text(argv[1]) : -EINVAL;
     }
 
-    file_name = argv[2];
-    int fd = open(file_name, O_RDONLY);
-    if (fd < 0) {
-	printf("ERROR: unable to open %s\n", file_name);
-	return -ENOENT;
+    if (argc < 2) return -EINVAL;
+    file_name = argv[1];
+    struct Image image;
+    int error = open_image(&image, file_name);
+    if (error) return error;
+
+    switch (argv[0][1]) {
+    case 'z':
+	pack = 1;
+    case 'b':
+	if (target == ZXS) {
+	    for (int i = 2; i < argc; i++) {
+		colors[i - 1] = atoi(argv[i]);
+	    }
+	    memset(inkmap, 0, sizeof(inkmap));
+	    save_bitmap(&image);
+	}
+	else {
+	    save_bitmap_cpc(&image);
+	}
+	break;
+    case 't':
+	if (target == ZXS) {
+	    for (int i = 2; i < argc; i++) {
+		colors[i - 1] = atoi(argv[i]);
+	    }
+	}
+	save_tiles(&image);
+	break;
+    case 'f':
+	if (target == CPC) {
+	    save_font_cpc(&image);
+	}
+	break;
     }
 
-    struct Header header;
-    read(fd, &header, sizeof(header));
+    close(image.fd);
+    return 0;
+}
 
-    if (header.image_type != 3 || header.depth != 8) {
-	printf("ERROR: not a grayscale 8-bit TGA file\n");
-	close(fd);
-	return 0;
+#define MAX_ARGS	32
+#define MAX_JOBS	256
+
+struct Job {
+    int target;
+    int top;
+    int scratch;
+    int cold;
+    int argc;
+    char *argv[MAX_ARGS];
+    char cache[64];
+    pid_t pid;
+};
+
+static unsigned long long hash_bytes(unsigned long long hash,
+				     const void *ptr, int size) {
+    for (int i = 0; i < size; i++) {
+	hash = (hash ^ ((unsigned char *) ptr)[i]) * 0x100000001b3ULL;
     }
+    return hash;
+}
 
-    int size = header.w * header.h;
-    unsigned char buf[size];
-    read(fd, buf, size);
+static unsigned long long hash_file(unsigned long long hash, const char *name) {
+    int size;
+    unsigned char buf[4096];
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) return hash;
+    while ((size = read(fd, buf, sizeof(buf))) > 0) {
+	hash = hash_bytes(hash, buf, size);
+    }
     close(fd);
+    return hash;
+}
 
-    switch (argv[1][1]) {
-    case 'b':
-#ifdef ZXS
-	for (int i = 3; i < argc; i++) {
-	    colors[i - 2] = atoi(argv[i]);
+static void job_cache(struct Job *job, unsigned long long tool) {
+    unsigned long long hash = tool;
+    hash = hash_bytes(hash, targets[job->target], 3);
+    hash = hash_bytes(hash, job->top ? "bin" : "txt", 3);
+    for (int i = 0; i < job->argc; i++) {
+	hash = hash_bytes(hash, job->argv[i], strlen(job->argv[i]) + 1);
+    }
+    if (job->argc > 1) hash = hash_file(hash, job->argv[1]);
+    sprintf(job->cache, CACHE "/%016llx.h", hash);
+}
+
+static void start_job(struct Job *job) {
+    fflush(stdout);
+    job->pid = fork();
+    if (job->pid == 0) {
+	char temp[80];
+	sprintf(temp, "%s.%d", job->cache, getpid());
+	if (freopen(temp, "w", stdout) == NULL) exit(-EIO);
+	target = job->target;
+	binary = job->top != 0;
+	int error = convert(job->argc, job->argv);
+	fflush(stdout);
+	if (error == 0) rename(temp, job->cache); else unlink(temp);
+	exit(error == 0 ? 0 : 1);
+    }
+}
+
+static int finish_job(struct Job *jobs, int count) {
+    int status;
+    pid_t pid = wait(&status);
+    for (int i = 0; i < count; i++) {
+	if (jobs[i].pid == pid) {
+	    jobs[i].pid = 0;
+	    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) return 0;
+	    fprintf(stderr, "ERROR: %s %s failed\n",
+		    targets[jobs[i].target], jobs[i].argv[0]);
+	    return -1;
 	}
-	memset(inkmap, 0, sizeof(inkmap));
-	save_bitmap(&header, buf, size);
-#endif
-#ifdef CPC
-	save_bitmap_cpc(&header, buf);
-#endif
-	break;
-    case 'f':
-#ifdef CPC
-	save_font_cpc(&header, buf);
-#endif
-	break;
     }
+    return -1;
+}
+
+static int run_jobs(struct Job *jobs, int count) {
+    int error = 0, running = 0;
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < count; i++) {
+	if (access(jobs[i].cache, F_OK) == 0) continue;
+	if (running == cores) {
+	    error |= finish_job(jobs, count);
+	    running--;
+	}
+	start_job(jobs + i);
+	running++;
+    }
+    while (running-- > 0) error |= finish_job(jobs, count);
+    return error;
+}
+
+static int write_header(struct Job *jobs, int count, int target) {
+    char name[64], temp[80];
+    sprintf(name, "data-%s.h", targets[target]);
+    sprintf(temp, "%s.tmp", name);
+    FILE *out = fopen(temp, "w");
+    if (out == NULL) return -EIO;
+    for (int i = 0; i < count; i++) {
+	if (jobs[i].target != target) continue;
+	FILE *in = fopen(jobs[i].cache, "r");
+	if (in == NULL) {
+	    fclose(out);
+	    remove(temp);
+	    return -EIO;
+	}
+	int size;
+	char buf[4096];
+	while ((size = fread(buf, 1, sizeof(buf), in)) > 0) {
+	    fwrite(buf, 1, size, out);
+	}
+	fclose(in);
+    }
+    fclose(out);
+    return rename(temp, name);
+}
+
+static int read_arrays(FILE *in, struct Array **arrays, int count) {
+    char type[8], name[256];
+    int align, size;
+    while (fscanf(in, "%7s %255s %d %d", type, name, &align, &size) == 4) {
+	fgetc(in);
+	*arrays = realloc(*arrays, (count + 1) * sizeof(struct Array));
+	struct Array *array = *arrays + count++;
+	array->type = strcmp(type, "word") ? "byte" : "word";
+	strcpy(array->name, name);
+	array->align = align;
+	array->size = size;
+	array->data = malloc(size);
+	if (fread(array->data, 1, size, in) != size) return -1;
+    }
+    return count;
+}
+
+/* cold arrays laid out from the scratch address, packed into one */
+static int pack_cold(struct Array *arrays, int n, int *offset) {
+    int size = 0;
+    for (int align = 256; align > 0; align >>= 1) {
+	for (int i = 0; i < n; i++) {
+	    if (arrays[i].align != align || !arrays[i].cold) continue;
+	    size = (size + align - 1) & ~(align - 1);
+	    offset[i] = size;
+	    size += arrays[i].size;
+	}
+    }
+    if (size == 0) return 0;
+    unsigned char *plain = calloc(size, 1);
+    for (int i = 0; i < n; i++) {
+	if (arrays[i].cold) {
+	    memcpy(plain + offset[i], arrays[i].data, arrays[i].size);
+	}
+    }
+    struct Array *packed = arrays + n;
+    packed->type = "byte";
+    strcpy(packed->name, "cold");
+    packed->align = 1;
+    packed->data = malloc(2 * size);
+    packed->size = pack_buffer(packed->data, plain, size, 1);
+    packed->cold = 0;
+    free(plain);
+    return size;
+}
+
+/*
+ * Arrays are laid out by descending alignment, so page aligned
+ * tables pack without gaps, and the blob ends just below top.
+ * Given a scratch address the arrays of -c manifest lines are placed
+ * there instead and the blob carries them packed, for load_overlay().
+ */
+static int write_blob(struct Job *jobs, int count, int target, int top,
+		      int scratch) {
+    int n = 0, size = 0;
+    struct Array *arrays = NULL;
+    for (int i = 0; i < count; i++) {
+	if (jobs[i].target != target) continue;
+	FILE *in = fopen(jobs[i].cache, "r");
+	if (in == NULL) return -EIO;
+	int first = n;
+	n = read_arrays(in, &arrays, n);
+	fclose(in);
+	if (n < 0) return -EIO;
+	for (int j = first; j < n; j++) {
+	    arrays[j].cold = scratch && jobs[i].cold;
+	}
+    }
+    int offset[n + 1];
+    arrays = realloc(arrays, (n + 1) * sizeof(struct Array));
+    int cold = pack_cold(arrays, n, offset);
+    if (cold > 0) {
+	fprintf(stderr, "COLD:%s BASE:0x%04x SIZE:%d PACKED:%d\n",
+		targets[target], scratch, cold, arrays[n].size);
+	n++;
+    }
+    for (int align = 256; align > 0; align >>= 1) {
+	for (int i = 0; i < n; i++) {
+	    if (arrays[i].align != align || arrays[i].cold) continue;
+	    size = (size + align - 1) & ~(align - 1);
+	    offset[i] = size;
+	    size += arrays[i].size;
+	}
+    }
+    int base = (top - size) & ~0xff;
+    if (base < 0) return -E2BIG;
+
+    char name[64];
+    sprintf(name, "data-%s.bin", targets[target]);
+    FILE *out = fopen(name, "w");
+    if (out == NULL) return -EIO;
+    unsigned char *blob = calloc(size, 1);
+    for (int i = 0; i < n; i++) {
+	if (arrays[i].cold) continue;
+	memcpy(blob + offset[i], arrays[i].data, arrays[i].size);
+    }
+    fwrite(blob, 1, size, out);
+    fclose(out);
+    free(blob);
 
+    sprintf(name, "data-%s.h", targets[target]);
+    out = fopen(name, "w");
+    if (out == NULL) return -EIO;
+    fprintf(out, "#define DATA_BASE 0x%04x\n", base);
+    fprintf(out, "#define DATA_SIZE %d\n", size);
+    if (cold > 0) {
+	fprintf(out, "#define COLD_BASE 0x%04x\n", scratch);
+	fprintf(out, "#define COLD_SIZE %d\n", cold);
+    }
+    for (int i = 0; i < n; i++) {
+	int step = strcmp(arrays[i].type, "word") ? 1 : 2;
+	int addr = (arrays[i].cold ? scratch : base) + offset[i];
+	fprintf(out, "__at (0x%04x) const %s %s[%d];\n", addr,
+		arrays[i].type, arrays[i].name, arrays[i].size / step);
+	free(arrays[i].data);
+    }
+    fclose(out);
+    free(arrays);
+    fprintf(stderr, "BLOB:%s BASE:0x%04x SIZE:%d\n",
+	    targets[target], base, size);
     return 0;
 }
+
+static int attach_blob(char *program, int origin, char *target) {
+    int base = -1;
+    char name[64], line[256];
+    sprintf(name, "data-%s.h", target);
+    FILE *header = fopen(name, "r");
+    if (header == NULL) return -ENOENT;
+    while (fgets(line, sizeof(line), header) != NULL) {
+	sscanf(line, "#define DATA_BASE %i", &base);
+    }
+    fclose(header);
+
+    FILE *out = fopen(program, "a");
+    sprintf(name, "data-%s.bin", target);
+    FILE *in = fopen(name, "r");
+    if (base < 0 || out == NULL || in == NULL) return -ENOENT;
+    fseek(out, 0, SEEK_END);
+    int end = origin + ftell(out);
+    if (end > base) {
+	fprintf(stderr, "ERROR: code overlaps data by %d bytes\n", end - base);
+	return -E2BIG;
+    }
+    fprintf(stderr, "FREE:%d\n", base - end);
+    for (int i = end; i < base; i++) fputc(0, out);
+    int size;
+    char buf[4096];
+    while ((size = fread(buf, 1, sizeof(buf), in)) > 0) {
+	fwrite(buf, 1, size, out);
+    }
+    fclose(in);
+    fclose(out);
+    return 0;
+}
+
+static void parse_target(struct Job *job, char *arg) {
+    char *top = strchr(arg, '@');
+    char *scratch = strchr(arg, ',');
+    job->target = strncmp(arg, "cpc", 3) ? ZXS : CPC;
+    job->top = top ? strtol(top + 1, NULL, 0) : 0;
+    job->scratch = scratch ? strtol(scratch + 1, NULL, 0) : 0;
+}
+
+static int save_manifest(char *manifest, int argc, char **argv) {
+    int count = 0;
+    char line[1024];
+    static struct Job jobs[MAX_JOBS];
+    FILE *file = fopen(manifest, "r");
+    if (file == NULL) {
+	fprintf(stderr, "ERROR: unable to open %s\n", manifest);
+	return -ENOENT;
+    }
+    mkdir(CACHE, 0755);
+    unsigned long long tool;
+    tool = hash_file(0xcbf29ce484222325ULL, "/proc/self/exe");
+    while (fgets(line, sizeof(line), file) != NULL) {
+	int n = 0;
+	char *args[MAX_ARGS];
+	for (char *i = strtok(line, " \t\n"); i; i = strtok(NULL, " \t\n")) {
+	    /* $NAME comes from the environment, dropped when empty */
+	    char *word = i[0] == '$' ? getenv(i + 1) : i;
+	    if (word && *word && n < MAX_ARGS) args[n++] = strdup(word);
+	}
+	if (n == 0 || args[0][0] == '#') continue;
+	int cold = strcmp(args[0], "-c") == 0;
+	for (int t = 0; t < argc; t++) {
+	    if (count == MAX_JOBS) {
+		fprintf(stderr, "ERROR: %s has over %d jobs\n",
+			manifest, MAX_JOBS);
+		fclose(file);
+		return -E2BIG;
+	    }
+	    struct Job *job = jobs + count++;
+	    parse_target(job, argv[t]);
+	    job->cold = cold;
+	    job->argc = n - cold;
+	    memcpy(job->argv, args + cold, sizeof(args) - cold * sizeof(*args));
+	    job_cache(job, tool);
+	}
+    }
+    fclose(file);
+
+    int error = run_jobs(jobs, count);
+    for (int t = 0; error == 0 && t < argc; t++) {
+	struct Job job;
+	parse_target(&job, argv[t]);
+	if (job.top) {
+	    error = write_blob(jobs, count, job.target, job.top, job.scratch);
+	}
+	else {
+	    error = write_header(jobs, count, job.target);
+	}
+    }
+    return error;
+}
+
+/*
+ * -x n times each converter stage on a synthetic n x n image of random
+ * two-tone cells and a level canvas of 32 * n rows. The stages write to
+ * /dev/null, the report goes to stderr per stage: bytes are input
+ * pixels, canvas rows of 16 bytes or the line table, cells are 8x8
+ * cells, canvas rows or line table entries.
+ */
+#define BENCH_TIME	0.5
+
+static FILE *report;
+static int bench_size, bench_rows;
+static unsigned char *bench_pixels;
+static unsigned short *bench_on;
+static char bench_file[] = "/tmp/tga-dump-XXXXXX";
+static struct Canvas bench_canvas;
+static volatile unsigned bench_sink;
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void bench_stage(const char *name, void (*run)(void),
+			long long bytes, long long cells) {
+    int passes = 0;
+    double start = now(), time;
+    do {
+	run();
+	passes++;
+	time = now() - start;
+    } while (time < BENCH_TIME);
+    time /= passes;
+    fprintf(report, "BENCH:%s PASSES:%d MS:%.3f MB/S:%.1f CELLS/S:%.0f\n",
+	    name, passes, 1e3 * time, bytes / time / 1e6, cells / time);
+}
+
+static void run_on_pixel(void) {
+    int w = bench_size, n = 0;
+    for (int y = 0; y < w; y += 8) {
+	for (int x = 0; x < w; x += 8) {
+	    bench_on[n++] = on_pixel(bench_pixels + y * w, x, w);
+	}
+    }
+}
+
+static void run_consume_pixels(void) {
+    int w = bench_size, n = 0;
+    unsigned sum = 0;
+    for (int y = 0; y < w; y += 8) {
+	for (int x = 0; x < w; x += 8) {
+	    unsigned char on = bench_on[n++] & 0xff;
+	    for (int i = 0; i < 8; i++) {
+		sum += consume_pixels(bench_pixels + (y + i) * w + x, on);
+	    }
+	}
+    }
+    bench_sink = sum;
+}
+
+static void run_encode_ink(void) {
+    int cells = (bench_size / 8) * (bench_size / 8);
+    unsigned sum = 0;
+    for (int i = 0; i < cells; i++) sum += encode_ink(bench_on[i]);
+    bench_sink = sum;
+}
+
+static void run_image(void (*save)(struct Image *image)) {
+    struct Image image;
+    if (open_image(&image, bench_file)) exit(-EIO);
+    save(&image);
+    close(image.fd);
+}
+
+static void run_save_bitmap(void) {
+    target = ZXS;
+    run_image(&save_bitmap);
+}
+
+static void run_save_packed(void) {
+    target = ZXS;
+    pack = 1;
+    run_image(&save_bitmap);
+    pack = 0;
+}
+
+static void run_save_bitmap_cpc(void) {
+    target = CPC;
+    run_image(&save_bitmap_cpc);
+}
+
+static void run_save_font_cpc(void) {
+    target = CPC;
+    run_image(&save_font_cpc);
+}
+
+static void run_save_lines(void) {
+    target = ZXS;
+    save_lines();
+}
+
+static int bench_fill(struct Canvas *c) {
+    c->rows = malloc(bench_rows * sizeof(row_t));
+    memcpy(c->rows, bench_canvas.rows, bench_rows * sizeof(row_t));
+    c->height = bench_rows;
+    return bench_rows;
+}
+
+static void run_serialize(void) {
+    struct Level l = { "bench", &bench_fill, 1, 1 };
+    serialize(&l);
+    clear_canvas(&l.canvas);
+    free(l.data);
+}
+
+/* the brush primitives, one shape every 8 rows down the canvas */
+static void run_taper(void) {
+    struct Canvas c = { 0, NULL };
+    for (int y = 0; y < bench_rows; y += 8) little_star(&c, y & 127, y);
+    clear_canvas(&c);
+}
+
+static void run_thick_line(void) {
+    struct Canvas c = { 0, NULL };
+    for (int y = 0; y < bench_rows; y += 8) {
+	thick_line(&c, y & 127, y, (y + 40) & 127, y + 24, 2);
+    }
+    clear_canvas(&c);
+}
+
+/* random two-tone cells out of eight grays, top-down grayscale TGA */
+static int write_bench_image(struct Random *r) {
+    int w = bench_size;
+    for (int y = 0; y < w; y += 8) {
+	for (int x = 0; x < w; x += 8) {
+	    unsigned char a = 36 * (next_random(r) & 7) + 3;
+	    unsigned char b = 36 * (next_random(r) & 7) + 3;
+	    for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+		    int on = next_random(r) & 1;
+		    bench_pixels[(y + i) * w + x + j] = on ? a : b;
+		}
+	    }
+	}
+    }
+    struct Header header;
+    memset(&header, 0, sizeof(header));
+    header.image_type = 3;
+    header.w = header.h = w;
+    header.depth = 8;
+    header.desc = 0x20;
+    int fd = mkstemp(bench_file);
+    if (fd < 0) return -EIO;
+    int error = write(fd, &header, sizeof(header)) != sizeof(header)
+	|| write(fd, bench_pixels, w * w) != w * w;
+    close(fd);
+    return error ? -EIO : 0;
+}
+
+static void draw_bench_canvas(struct Random *r) {
+    canvas_grow(&bench_canvas, bench_rows);
+    for (int y = 0; y < bench_rows; y += 4) {
+	int x = next_random(r) % 128;
+	int dx = next_random(r) % 33 - 16;
+	line(&bench_canvas, x, y, x + dx, y + next_random(r) % 32);
+    }
+}
+
+static int benchmark(int size) {
+    if (size < 8 || size > 0xfff8 || (size & 7)) {
+	fprintf(stderr, "ERROR: size must be a multiple of 8\n");
+	return -EINVAL;
+    }
+    struct Random r;
+    seed_random(&r, 1);
+    bench_size = size;
+    bench_rows = 32 * size;
+    bench_pixels = malloc((long) size * size);
+    bench_on = malloc((size / 8) * (size / 8) * sizeof(*bench_on));
+    if (write_bench_image(&r) < 0) {
+	fprintf(stderr, "ERROR: unable to write %s\n", bench_file);
+	return -EIO;
+    }
+    draw_bench_canvas(&r);
+
+    report = fdopen(dup(2), "w");
+    setvbuf(report, NULL, _IOLBF, 0);
+    freopen("/dev/null", "w", stdout);
+    freopen("/dev/null", "w", stderr);
+    file_name = "bench.tga";
+    binary = 1;
+    for (int i = 1; i < 16; i++) colors[i] = i;
+
+    long long pixels = (long long) size * size, cells = pixels / 64;
+    fprintf(report, "IMAGE:%dx%d CELLS:%lld ROWS:%d\n",
+	    size, size, cells, bench_rows);
+    bench_stage("on_pixel", &run_on_pixel, pixels, cells);
+    bench_stage("consume_pixels", &run_consume_pixels, pixels, cells);
+    bench_stage("encode_ink", &run_encode_ink, pixels, cells);
+    bench_stage("save_bitmap", &run_save_bitmap, pixels, cells);
+    bench_stage("save_bitmap/packed", &run_save_packed, pixels, cells);
+    bench_stage("save_bitmap_cpc", &run_save_bitmap_cpc, pixels, cells);
+    bench_stage("save_font_cpc", &run_save_font_cpc, pixels, cells);
+    bench_stage("save_lines", &run_save_lines, 3 * 4096, 4096);
+    bench_stage("serialize", &run_serialize, 16LL * bench_rows, bench_rows);
+    bench_stage("taper", &run_taper, 16LL * bench_rows, bench_rows);
+    bench_stage("thick_line", &run_thick_line, 16LL * bench_rows, bench_rows);
+
+    unlink(bench_file);
+    clear_canvas(&bench_canvas);
+    free(bench_on);
+    free(bench_pixels);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+	printf("USAGE: tga-dump [zxs|cpc] [option] file.tga\n");
+	printf("       tga-dump -m manifest [zxs[@top[,scratch]]] "
+	       "[cpc[@top[,scratch]]]\n");
+	printf("       tga-dump -a program.bin origin zxs|cpc\n");
+	printf("       tga-dump -x size\n");
+	printf("  -b   save bitmap\n");
+	printf("  -z   save packed bitmap\n");
+	printf("  -t   save tiles and tile map\n");
+	printf("  -f   save font cpc\n");
+	printf("  -l   save line data\n");
+	printf("  -g   save game data, with a keyframe every n frames\n");
+	printf("  -s   save text file\n");
+	printf("  -m   save data-zxs.h and data-cpc.h from manifest,\n");
+	printf("       with @top as data-*.bin blobs ending below top,\n");
+	printf("       lines starting -c packed and unpacked to scratch\n");
+	printf("  -a   append data-*.bin blob to program.bin\n");
+	printf("  -x   time converter stages on a synthetic size x size image\n");
+	return 0;
+    }
+
+    if (strcmp(argv[1], "-m") == 0 && argc > 2) {
+	return save_manifest(argv[2], argc - 3, argv + 3);
+    }
+
+    if (strcmp(argv[1], "-a") == 0 && argc > 4) {
+	return attach_blob(argv[2], strtol(argv[3], NULL, 0), argv[4]);
+    }
+
+    if (strcmp(argv[1], "-x") == 0 && argc > 2) {
+	return benchmark(atoi(argv[2]));
+    }
+
+    if (strcmp(argv[1], "zxs") == 0 || strcmp(argv[1], "cpc") == 0) {
+	target = strcmp(argv[1], "cpc") ? ZXS : CPC;
+	argc--;
+	argv++;
+    }
+
+    return convert(argc - 1, argv + 1);
+}
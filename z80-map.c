@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+
+/* RAM budget of a build from sdld's .map and tga-dump's data-*.h
+ *
+ * Linker areas and their global symbols come from the map, the level
+ * and image tables from the header, the stack is its top and the depth
+ * z80-sim -s measured. Fixed regions such as ROM, screen and the IM 2
+ * table are given as name@start-end, both ends inclusive. Every byte
+ * is owned by one region at most, the rest is free.
+ *
+ * With -h the per-address counts of z80-sim -m are summed for every
+ * region and symbol instead, as CSV on stdout. */
+
+#define MAX_REGIONS	512
+#define MIN_GAP		16
+#define NONE		-1
+
+struct Region {
+    char name[64];
+    int start, end;
+    int symbol;
+};
+
+static struct Region regions[MAX_REGIONS];
+static int count;
+static short owner[0x10000];
+static int overlaps;
+static unsigned reads[0x10000];
+static unsigned writes[0x10000];
+static unsigned execs[0x10000];
+
+static struct Region *add_region(const char *name, int start, int end) {
+    if (count >= MAX_REGIONS) return NULL;
+    struct Region *region = regions + count++;
+    snprintf(region->name, sizeof(region->name), "%s", name);
+    region->start = start;
+    region->end = end;
+    region->symbol = 0;
+    return region;
+}
+
+static int by_start(const void *a, const void *b) {
+    const struct Region *x = a, *y = b;
+    if (x->start != y->start) return x->start - y->start;
+    return x->symbol - y->symbol;
+}
+
+/* symbols run up to the next symbol or the end of their area */
+static void size_symbols(int first, int last, int end) {
+    qsort(regions + first, last - first, sizeof(*regions), &by_start);
+    for (int i = first; i < last; i++) {
+	regions[i].end = i + 1 < last ? regions[i + 1].start : end;
+    }
+}
+
+static int read_map(const char *file) {
+    char line[256], name[64], attr[64];
+    int area = NONE, first = 0, end = 0;
+    FILE *f = fopen(file, "r");
+    if (f == NULL) return -ENOENT;
+    while (fgets(line, sizeof(line), f) != NULL) {
+	unsigned addr, size, bytes;
+	if (!isspace(line[0])
+	    && sscanf(line, "%63s %x %x = %u. bytes (%63[^)]",
+		      name, &addr, &size, &bytes, attr) == 5) {
+	    if (area != NONE) size_symbols(first, count, end);
+	    area = NONE;
+	    if (size == 0 || strstr(attr, "ABS")) continue;
+	    area = count;
+	    end = addr + size;
+	    add_region(name, addr, end);
+	    first = count;
+	}
+	else if (area != NONE && isspace(line[0])
+		 && sscanf(line, "%x %63s", &addr, name) == 2
+		 && name[0] == '_' && addr >= regions[area].start
+		 && addr < end) {
+	    struct Region *region = add_region(name, addr, end);
+	    if (region) region->symbol = 1;
+	}
+    }
+    if (area != NONE) size_symbols(first, count, end);
+    fclose(f);
+    return 0;
+}
+
+static int read_header(const char *file) {
+    char line[256], type[16], name[64];
+    int base = NONE, size = 0, first = count, cold = NONE, cold_size = 0;
+    FILE *f = fopen(file, "r");
+    if (f == NULL) return -ENOENT;
+    while (fgets(line, sizeof(line), f) != NULL) {
+	unsigned addr, n;
+	sscanf(line, "#define DATA_BASE %i", &base);
+	sscanf(line, "#define DATA_SIZE %i", &size);
+	sscanf(line, "#define COLD_BASE %i", &cold);
+	sscanf(line, "#define COLD_SIZE %i", &cold_size);
+	if (sscanf(line, "__at (%x) const %15s %63[^[][%u]",
+		   &addr, type, name, &n) == 4) {
+	    int step = strcmp(type, "word") ? 1 : 2;
+	    struct Region *region = add_region(name, addr, addr + n * step);
+	    if (region) region->symbol = 1;
+	}
+    }
+    fclose(f);
+    if (base == NONE) return -EINVAL;
+    add_region("blob", base, base + size);
+    if (cold != NONE) add_region("cold", cold, cold + cold_size);
+    qsort(regions + first, count - first, sizeof(*regions), &by_start);
+    return 0;
+}
+
+static int parse_region(const char *arg) {
+    char name[64];
+    int start, end;
+    if (sscanf(arg, "%63[^@]@%i-%i", name, &start, &end) != 3) {
+	return -EINVAL;
+    }
+    add_region(name, start, end + 1);
+    return 0;
+}
+
+static int read_heat(const char *file) {
+    char line[128];
+    FILE *f = fopen(file, "r");
+    if (f == NULL) return -ENOENT;
+    while (fgets(line, sizeof(line), f) != NULL) {
+	unsigned addr, r, w, x;
+	if (sscanf(line, "%x,%u,%u,%u", &addr, &r, &w, &x) == 4
+	    && addr < 0x10000) {
+	    reads[addr] = r;
+	    writes[addr] = w;
+	    execs[addr] = x;
+	}
+    }
+    fclose(f);
+    return 0;
+}
+
+static void print_heat(struct Region *region) {
+    unsigned long long r = 0, w = 0, x = 0;
+    for (int i = region->start; i < region->end && i < 0x10000; i++) {
+	r += reads[i];
+	w += writes[i];
+	x += execs[i];
+    }
+    printf("%s,%s,0x%04x,%d,%llu,%llu,%llu\n",
+	   region->symbol ? "symbol" : "region", region->name,
+	   region->start, region->end - region->start, r, w, x);
+}
+
+static void claim(int n) {
+    struct Region *region = regions + n;
+    for (int i = region->start; i < region->end && i < 0x10000; i++) {
+	if (owner[i] != NONE) {
+	    struct Region *other = regions + owner[i];
+	    int bytes = 0;
+	    while (i < region->end && owner[i] == other - regions) {
+		i++;
+		bytes++;
+	    }
+	    fprintf(stderr, "OVERLAP:%s:%s START:0x%04x BYTES:%d\n",
+		    other->name, region->name, i - bytes, bytes);
+	    overlaps++;
+	    i--;
+	}
+	else {
+	    owner[i] = n;
+	}
+    }
+}
+
+static void print_region(struct Region *region) {
+    printf("%s:%s START:0x%04x SIZE:%d\n",
+	   region->symbol ? "SYMBOL" : "REGION", region->name,
+	   region->start, region->end - region->start);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 5) {
+	printf("USAGE: z80-map program.map data.h stack_top depth "
+	       "[-h heat.csv] [name@start-end ...]\n");
+	printf("  sizes of areas, symbols and tables, overlaps between\n");
+	printf("  regions and the free bytes left, stack depth from z80-sim\n");
+	printf("  -h   access counts per region and symbol as CSV instead\n");
+	return 0;
+    }
+    if (read_map(argv[1]) < 0) {
+	fprintf(stderr, "ERROR: cannot read %s\n", argv[1]);
+	return -ENOENT;
+    }
+    if (read_header(argv[2]) < 0) {
+	fprintf(stderr, "ERROR: cannot read %s\n", argv[2]);
+	return -ENOENT;
+    }
+    int top = strtol(argv[3], NULL, 0);
+    int depth = atoi(argv[4]);
+    add_region("stack", top - depth, top);
+    const char *heat = NULL;
+    for (int i = 5; i < argc; i++) {
+	if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+	    heat = argv[++i];
+	}
+	else if (parse_region(argv[i]) < 0) {
+	    fprintf(stderr, "ERROR: bad region %s\n", argv[i]);
+	    return -EINVAL;
+	}
+    }
+
+    if (heat) {
+	if (read_heat(heat) < 0) {
+	    fprintf(stderr, "ERROR: cannot read %s\n", heat);
+	    return -ENOENT;
+	}
+	printf("kind,name,start,size,read,write,exec\n");
+	for (int i = 0; i < count; i++) print_heat(regions + i);
+	return 0;
+    }
+
+    int blob = NONE;
+    memset(owner, 0xff, sizeof(owner));
+    for (int i = 0; i < count; i++) {
+	print_region(regions + i);
+	if (regions[i].symbol) continue;
+	if (strcmp(regions[i].name, "blob") == 0) blob = regions[i].start;
+	claim(i);
+    }
+
+    int total = 0, levels = 0;
+    for (int i = 0; i < 0x10000; i++) {
+	if (owner[i] != NONE) continue;
+	int start = i;
+	while (i < 0x10000 && owner[i] == NONE) i++;
+	total += i - start;
+	if (i - start >= MIN_GAP) {
+	    printf("FREE:0x%04x SIZE:%d\n", start, i - start);
+	}
+	if (i == blob) levels = i - start;
+    }
+    /* the blob grows down as levels are added */
+    printf("LEVELS:%d TOTAL:%d\n", levels, total);
+    return overlaps > 0;
+}
@@ -0,0 +1,1424 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/* Z80 core with exact T-state counts, used to time pulzar routines */
+
+typedef unsigned char byte;
+typedef unsigned short word;
+
+#define FS	0x80
+#define FZ	0x40
+#define FY	0x20
+#define FH	0x10
+#define FX	0x08
+#define FP	0x04
+#define FN	0x02
+#define FC	0x01
+
+struct Z80 {
+    byte a, f, b, c, d, e, h, l;
+    word af_, bc_, de_, hl_;
+    word ix, iy, sp, pc;
+    byte i, r, im, iff1, iff2, halted, after_ei;
+    unsigned long long cycles;
+};
+
+static struct Z80 cpu;
+static byte memory[0x10000];
+static byte sz53p[256];
+
+static byte *code_map;
+static byte *write_map;
+static struct Heat *heat;
+static int (*contention)(word addr, unsigned long long when);
+static int offset;
+static int stall;
+static void (*port_out)(word port, byte data);
+static byte (*port_in)(word port);
+
+/* accesses per address, exec counts instructions started there */
+struct Heat {
+    unsigned read, write, exec;
+};
+
+#define BC	((cpu.b << 8) | cpu.c)
+#define DE	((cpu.d << 8) | cpu.e)
+#define HL	((cpu.h << 8) | cpu.l)
+
+static void set_pair(byte *hi, byte *lo, word v) {
+    *hi = v >> 8;
+    *lo = v;
+}
+
+#define SET_BC(x)	set_pair(&cpu.b, &cpu.c, x)
+#define SET_DE(x)	set_pair(&cpu.d, &cpu.e, x)
+#define SET_HL(x)	set_pair(&cpu.h, &cpu.l, x)
+
+static void init_tables(void) {
+    for (int i = 0; i < 256; i++) {
+	int parity = 0;
+	for (int bit = 0; bit < 8; bit++) parity ^= (i >> bit) & 1;
+	sz53p[i] = (i & (FS | FY | FX)) | (i ? 0 : FZ) | (parity ? 0 : FP);
+    }
+}
+
+/* memory accesses advance the clock within an instruction, 3T each
+ * and 4T for opcode fetches, so contention sees when they happen */
+static void bus_cycle(word addr, int length) {
+    if (contention) stall += contention(addr, cpu.cycles + offset + stall);
+    offset += length;
+}
+
+static byte rd(word addr) {
+    if (heat) heat[addr].read++;
+    bus_cycle(addr, 3);
+    return memory[addr];
+}
+
+static void wr(word addr, byte data) {
+    if (heat) heat[addr].write++;
+    if (write_map) write_map[addr] = 1;
+    bus_cycle(addr, 3);
+    memory[addr] = data;
+}
+
+static word rd16(word addr) {
+    return rd(addr) | (rd(addr + 1) << 8);
+}
+
+static void wr16(word addr, word data) {
+    wr(addr, data);
+    wr(addr + 1, data >> 8);
+}
+
+static byte fetch(void) {
+    if (code_map) code_map[cpu.pc] = 1;
+    return rd(cpu.pc++);
+}
+
+static byte opcode(void) {
+    if (code_map) code_map[cpu.pc] = 1;
+    if (heat) heat[cpu.pc].exec++;
+    bus_cycle(cpu.pc, 4);
+    cpu.r++;
+    return memory[cpu.pc++];
+}
+
+static word fetch16(void) {
+    byte lo = fetch();
+    return lo | (fetch() << 8);
+}
+
+static void push(word data) {
+    cpu.sp -= 2;
+    wr16(cpu.sp, data);
+}
+
+static word pop(void) {
+    word data = rd16(cpu.sp);
+    cpu.sp += 2;
+    return data;
+}
+
+static byte in(word port) {
+    return port_in ? port_in(port) : 0xff;
+}
+
+static void out(word port, byte data) {
+    if (port_out) port_out(port, data);
+}
+
+static void add8(byte v, int carry) {
+    int r = cpu.a + v + carry;
+    cpu.f = (r & (FS | FY | FX)) | ((r & 0xff) ? 0 : FZ)
+	| ((cpu.a ^ v ^ r) & FH)
+	| (((cpu.a ^ ~v) & (cpu.a ^ r) & 0x80) >> 5)
+	| ((r >> 8) & FC);
+    cpu.a = r;
+}
+
+static byte sub8(byte v, int carry) {
+    int r = cpu.a - v - carry;
+    cpu.f = FN | (r & (FS | FY | FX)) | ((r & 0xff) ? 0 : FZ)
+	| ((cpu.a ^ v ^ r) & FH)
+	| (((cpu.a ^ v) & (cpu.a ^ r) & 0x80) >> 5)
+	| ((r >> 8) & FC);
+    return r;
+}
+
+static void alu(int op, byte v) {
+    switch (op) {
+    case 0: add8(v, 0); break;
+    case 1: add8(v, cpu.f & FC); break;
+    case 2: cpu.a = sub8(v, 0); break;
+    case 3: cpu.a = sub8(v, cpu.f & FC); break;
+    case 4: cpu.a &= v; cpu.f = sz53p[cpu.a] | FH; break;
+    case 5: cpu.a ^= v; cpu.f = sz53p[cpu.a]; break;
+    case 6: cpu.a |= v; cpu.f = sz53p[cpu.a]; break;
+    case 7: sub8(v, 0); cpu.f = (cpu.f & ~(FY | FX)) | (v & (FY | FX)); break;
+    }
+}
+
+static byte inc8(byte v) {
+    byte r = v + 1;
+    cpu.f = (cpu.f & FC) | (sz53p[r] & ~FP)
+	| ((r & 0xf) ? 0 : FH) | (r == 0x80 ? FP : 0);
+    return r;
+}
+
+static byte dec8(byte v) {
+    byte r = v - 1;
+    cpu.f = (cpu.f & FC) | FN | (sz53p[r] & ~FP)
+	| ((v & 0xf) ? 0 : FH) | (r == 0x7f ? FP : 0);
+    return r;
+}
+
+static word add16(word x, word v) {
+    int r = x + v;
+    cpu.f = (cpu.f & (FS | FZ | FP)) | ((r >> 8) & (FY | FX))
+	| (((x ^ v ^ r) >> 8) & FH) | ((r >> 16) & FC);
+    return r;
+}
+
+static word adc16(word x, word v) {
+    int r = x + v + (cpu.f & FC);
+    cpu.f = ((r >> 8) & (FS | FY | FX)) | ((r & 0xffff) ? 0 : FZ)
+	| (((x ^ v ^ r) >> 8) & FH)
+	| (((x ^ ~v) & (x ^ r) & 0x8000) >> 13) | ((r >> 16) & FC);
+    return r;
+}
+
+static word sbc16(word x, word v) {
+    int r = x - v - (cpu.f & FC);
+    cpu.f = FN | ((r >> 8) & (FS | FY | FX)) | ((r & 0xffff) ? 0 : FZ)
+	| (((x ^ v ^ r) >> 8) & FH)
+	| (((x ^ v) & (x ^ r) & 0x8000) >> 13) | ((r >> 16) & FC);
+    return r;
+}
+
+static byte rotate(int op, byte v) {
+    int carry;
+    switch (op) {
+    case 0: carry = v >> 7; v = (v << 1) | carry; break;
+    case 1: carry = v & 1; v = (v >> 1) | (carry << 7); break;
+    case 2: carry = v >> 7; v = (v << 1) | (cpu.f & FC); break;
+    case 3: carry = v & 1; v = (v >> 1) | ((cpu.f & FC) << 7); break;
+    case 4: carry = v >> 7; v = v << 1; break;
+    case 5: carry = v & 1; v = (v >> 1) | (v & 0x80); break;
+    case 6: carry = v >> 7; v = (v << 1) | 1; break;
+    default: carry = v & 1; v = v >> 1; break;
+    }
+    cpu.f = sz53p[v] | carry;
+    return v;
+}
+
+static void bit(int n, byte v) {
+    byte r = v & (1 << n);
+    cpu.f = (cpu.f & FC) | FH | (v & (FY | FX))
+	| (r ? (r & FS) : (FZ | FP));
+}
+
+static void daa(void) {
+    int carry = cpu.f & FC, diff = 0;
+    int low = cpu.a & 0xf;
+    if ((cpu.f & FH) || low > 9) diff = 6;
+    if (carry || cpu.a > 0x99) {
+	diff |= 0x60;
+	carry = FC;
+    }
+    int half = (cpu.f & FN) ? (cpu.f & FH) && low < 6 : low > 9;
+    cpu.a = (cpu.f & FN) ? cpu.a - diff : cpu.a + diff;
+    cpu.f = sz53p[cpu.a] | carry | (cpu.f & FN) | (half ? FH : 0);
+}
+
+static int condition(int cc) {
+    static const byte mask[] = { FZ, FC, FP, FS };
+    int set = (cpu.f & mask[cc >> 1]) != 0;
+    return (cc & 1) ? set : !set;
+}
+
+/* register r[] of the opcode tables, H and L may be IXh/IXl */
+static byte get_reg(int r, word *index) {
+    switch (r) {
+    case 0: return cpu.b;
+    case 1: return cpu.c;
+    case 2: return cpu.d;
+    case 3: return cpu.e;
+    case 4: return index ? *index >> 8 : cpu.h;
+    case 5: return index ? *index & 0xff : cpu.l;
+    default: return cpu.a;
+    }
+}
+
+static void set_reg(int r, byte v, word *index) {
+    switch (r) {
+    case 0: cpu.b = v; break;
+    case 1: cpu.c = v; break;
+    case 2: cpu.d = v; break;
+    case 3: cpu.e = v; break;
+    case 4: if (index) *index = (*index & 0xff) | (v << 8); else cpu.h = v;
+	break;
+    case 5: if (index) *index = (*index & 0xff00) | v; else cpu.l = v;
+	break;
+    default: cpu.a = v; break;
+    }
+}
+
+static word get_rp(int p, word *index) {
+    switch (p) {
+    case 0: return BC;
+    case 1: return DE;
+    case 2: return index ? *index : HL;
+    default: return cpu.sp;
+    }
+}
+
+static void set_rp(int p, word v, word *index) {
+    switch (p) {
+    case 0: SET_BC(v); break;
+    case 1: SET_DE(v); break;
+    case 2: if (index) *index = v; else SET_HL(v); break;
+    default: cpu.sp = v; break;
+    }
+}
+
+/* CB and DD CB, counted without the DD/FD prefix */
+static int execute_cb(word *index) {
+    if (index) {
+	word addr = *index + (signed char) fetch();
+	byte op = fetch();
+	int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+	byte v = rd(addr);
+	if (x == 1) {
+	    bit(y, v);
+	    cpu.f = (cpu.f & ~(FY | FX)) | ((addr >> 8) & (FY | FX));
+	    return 16;
+	}
+	if (x == 0) v = rotate(y, v);
+	if (x == 2) v &= ~(1 << y);
+	if (x == 3) v |= 1 << y;
+	wr(addr, v);
+	if (z != 6) set_reg(z, v, NULL);
+	return 19;
+    }
+    byte op = opcode();
+    int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+    byte v = z == 6 ? rd(HL) : get_reg(z, NULL);
+    if (x == 1) {
+	bit(y, v);
+	return z == 6 ? 12 : 8;
+    }
+    if (x == 0) v = rotate(y, v);
+    if (x == 2) v &= ~(1 << y);
+    if (x == 3) v |= 1 << y;
+    if (z == 6) wr(HL, v); else set_reg(z, v, NULL);
+    return z == 6 ? 15 : 8;
+}
+
+static int block(int y, int z) {
+    int step = (y & 1) ? -1 : 1;
+    int repeat = y >= 6;
+    word bc = BC - 1;
+    switch (z) {
+    case 0: {
+	byte v = rd(HL);
+	wr(DE, v);
+	SET_HL(HL + step);
+	SET_DE(DE + step);
+	SET_BC(bc);
+	int n = cpu.a + v;
+	cpu.f = (cpu.f & (FS | FZ | FC)) | (bc ? FP : 0)
+	    | (n & FX) | ((n & 0x02) << 4);
+	repeat = repeat && bc;
+	break;
+    }
+    case 1: {
+	byte v = rd(HL);
+	byte r = cpu.a - v;
+	SET_HL(HL + step);
+	SET_BC(bc);
+	cpu.f = (cpu.f & FC) | FN | (r & FS) | (r ? 0 : FZ)
+	    | ((cpu.a ^ v ^ r) & FH) | (bc ? FP : 0);
+	int n = r - ((cpu.f & FH) ? 1 : 0);
+	cpu.f |= (n & FX) | ((n & 0x02) << 4);
+	repeat = repeat && bc && r;
+	break;
+    }
+    case 2:
+	wr(HL, in(BC));
+	SET_HL(HL + step);
+	cpu.b--;
+	cpu.f = FN | (sz53p[cpu.b] & ~FP) | (cpu.f & FC);
+	repeat = repeat && cpu.b;
+	break;
+    default:
+	cpu.b--;
+	out(BC, rd(HL));
+	SET_HL(HL + step);
+	cpu.f = FN | (sz53p[cpu.b] & ~FP) | (cpu.f & FC);
+	repeat = repeat && cpu.b;
+	break;
+    }
+    if (repeat) {
+	cpu.pc -= 2;
+	return 21;
+    }
+    return 16;
+}
+
+static int execute_ed(void) {
+    byte op = opcode();
+    int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+    int p = y >> 1, q = y & 1;
+    if (x == 2 && z <= 3 && y >= 4) return block(y, z);
+    if (x != 1) return 8;
+    switch (z) {
+    case 0: {
+	byte v = in(BC);
+	if (y != 6) set_reg(y, v, NULL);
+	cpu.f = (cpu.f & FC) | sz53p[v];
+	return 12;
+    }
+    case 1:
+	out(BC, y == 6 ? 0 : get_reg(y, NULL));
+	return 12;
+    case 2:
+	SET_HL(q ? adc16(HL, get_rp(p, NULL)) : sbc16(HL, get_rp(p, NULL)));
+	return 15;
+    case 3: {
+	word addr = fetch16();
+	if (q) set_rp(p, rd16(addr), NULL); else wr16(addr, get_rp(p, NULL));
+	return 20;
+    }
+    case 4: {
+	byte v = cpu.a;
+	cpu.a = 0;
+	cpu.a = sub8(v, 0);
+	return 8;
+    }
+    case 5:
+	cpu.iff1 = cpu.iff2;
+	cpu.pc = pop();
+	return 14;
+    case 6:
+	cpu.im = (y & 3) < 2 ? 0 : (y & 3) - 1;
+	return 8;
+    default:
+	switch (y) {
+	case 0: cpu.i = cpu.a; return 9;
+	case 1: cpu.r = cpu.a; return 9;
+	case 2:
+	case 3:
+	    cpu.a = y == 2 ? cpu.i : cpu.r;
+	    cpu.f = (cpu.f & FC) | (sz53p[cpu.a] & ~FP) | (cpu.iff2 ? FP : 0);
+	    return 9;
+	case 4: {
+	    byte v = rd(HL);
+	    wr(HL, (cpu.a << 4) | (v >> 4));
+	    cpu.a = (cpu.a & 0xf0) | (v & 0x0f);
+	    cpu.f = (cpu.f & FC) | sz53p[cpu.a];
+	    return 18;
+	}
+	case 5: {
+	    byte v = rd(HL);
+	    wr(HL, (v << 4) | (cpu.a & 0x0f));
+	    cpu.a = (cpu.a & 0xf0) | (v >> 4);
+	    cpu.f = (cpu.f & FC) | sz53p[cpu.a];
+	    return 18;
+	}
+	default:
+	    return 8;
+	}
+    }
+}
+
+/* one instruction, returns T-states; index is IX/IY after a DD/FD prefix */
+static int execute(void) {
+    word *index = NULL;
+    byte op = opcode();
+    int t = 0;
+    while (op == 0xdd || op == 0xfd) {
+	index = op == 0xdd ? &cpu.ix : &cpu.iy;
+	op = opcode();
+	t += 4;
+    }
+    int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+    int p = y >> 1, q = y & 1;
+    word addr = 0;
+
+    /* (HL) operand, (IX+d) costs 8 more than (HL) */
+    int memory_op = (x == 0 && (z == 4 || z == 5 || z == 6) && y == 6)
+	|| (x == 1 && (y == 6 || z == 6) && op != 0x76)
+	|| (x == 2 && z == 6);
+    if (memory_op) {
+	addr = index ? *index + (signed char) fetch() : HL;
+	if (index) t += (op == 0x36) ? 5 : 8;
+    }
+
+    switch (x) {
+    case 0:
+	switch (z) {
+	case 0:
+	    switch (y) {
+	    case 0: return t + 4;
+	    case 1: {
+		word af = (cpu.a << 8) | cpu.f;
+		cpu.a = cpu.af_ >> 8;
+		cpu.f = cpu.af_;
+		cpu.af_ = af;
+		return t + 4;
+	    }
+	    case 2: {
+		signed char d = fetch();
+		if (--cpu.b) {
+		    cpu.pc += d;
+		    return t + 13;
+		}
+		return t + 8;
+	    }
+	    case 3: {
+		signed char d = fetch();
+		cpu.pc += d;
+		return t + 12;
+	    }
+	    default: {
+		signed char d = fetch();
+		if (condition(y - 4)) {
+		    cpu.pc += d;
+		    return t + 12;
+		}
+		return t + 7;
+	    }
+	    }
+	case 1:
+	    if (q == 0) {
+		set_rp(p, fetch16(), index);
+		return t + 10;
+	    }
+	    set_rp(2, add16(get_rp(2, index), get_rp(p, index)), index);
+	    return t + 11;
+	case 2:
+	    switch (y) {
+	    case 0: wr(BC, cpu.a); return t + 7;
+	    case 1: cpu.a = rd(BC); return t + 7;
+	    case 2: wr(DE, cpu.a); return t + 7;
+	    case 3: cpu.a = rd(DE); return t + 7;
+	    case 4: wr16(fetch16(), get_rp(2, index)); return t + 16;
+	    case 5: set_rp(2, rd16(fetch16()), index); return t + 16;
+	    case 6: wr(fetch16(), cpu.a); return t + 13;
+	    default: cpu.a = rd(fetch16()); return t + 13;
+	    }
+	case 3:
+	    set_rp(p, get_rp(p, index) + (q ? -1 : 1), index);
+	    return t + 6;
+	case 4:
+	case 5:
+	    if (y == 6) {
+		wr(addr, z == 4 ? inc8(rd(addr)) : dec8(rd(addr)));
+		return t + 11;
+	    }
+	    byte v = get_reg(y, index);
+	    set_reg(y, z == 4 ? inc8(v) : dec8(v), index);
+	    return t + 4;
+	case 6:
+	    if (y == 6) {
+		wr(addr, fetch());
+		return t + 10;
+	    }
+	    set_reg(y, fetch(), index);
+	    return t + 7;
+	default: {
+	    byte keep = cpu.f & (FS | FZ | FP);
+	    switch (y) {
+	    case 0:
+	    case 1:
+	    case 2:
+	    case 3:
+		cpu.a = rotate(y, cpu.a);
+		cpu.f = keep | (cpu.f & (FY | FX | FC));
+		break;
+	    case 4: daa(); break;
+	    case 5:
+		cpu.a ^= 0xff;
+		cpu.f = (cpu.f & (FS | FZ | FP | FC)) | FH | FN
+		    | (cpu.a & (FY | FX));
+		break;
+	    case 6:
+		cpu.f = keep | FC | (cpu.a & (FY | FX));
+		break;
+	    default:
+		cpu.f = keep | ((cpu.f & FC) ? FH : FC) | (cpu.a & (FY | FX));
+		break;
+	    }
+	    return t + 4;
+	}
+	}
+    case 1:
+	if (op == 0x76) {
+	    cpu.halted = 1;
+	    cpu.pc--;
+	    return t + 4;
+	}
+	if (z == 6) {
+	    set_reg(y, rd(addr), NULL);
+	    return t + 7;
+	}
+	if (y == 6) {
+	    wr(addr, get_reg(z, NULL));
+	    return t + 7;
+	}
+	set_reg(y, get_reg(z, index), index);
+	return t + 4;
+    case 2:
+	alu(y, z == 6 ? rd(addr) : get_reg(z, index));
+	return t + (z == 6 ? 7 : 4);
+    default:
+	switch (z) {
+	case 0:
+	    if (condition(y)) {
+		cpu.pc = pop();
+		return t + 11;
+	    }
+	    return t + 5;
+	case 1:
+	    if (q == 0) {
+		word v = pop();
+		if (p == 3) {
+		    cpu.a = v >> 8;
+		    cpu.f = v;
+		}
+		else {
+		    set_rp(p, v, index);
+		}
+		return t + 10;
+	    }
+	    switch (p) {
+	    case 0:
+		cpu.pc = pop();
+		return t + 10;
+	    case 1: {
+		word bc = BC, de = DE, hl = HL;
+		SET_BC(cpu.bc_);
+		SET_DE(cpu.de_);
+		SET_HL(cpu.hl_);
+		cpu.bc_ = bc;
+		cpu.de_ = de;
+		cpu.hl_ = hl;
+		return t + 4;
+	    }
+	    case 2:
+		cpu.pc = get_rp(2, index);
+		return t + 4;
+	    default:
+		cpu.sp = get_rp(2, index);
+		return t + 6;
+	    }
+	case 2: {
+	    word nn = fetch16();
+	    if (condition(y)) cpu.pc = nn;
+	    return t + 10;
+	}
+	case 3:
+	    switch (y) {
+	    case 0:
+		cpu.pc = fetch16();
+		return t + 10;
+	    case 1:
+		return t + execute_cb(index);
+	    case 2:
+		out((cpu.a << 8) | fetch(), cpu.a);
+		return t + 11;
+	    case 3:
+		cpu.a = in((cpu.a << 8) | fetch());
+		return t + 11;
+	    case 4: {
+		word v = rd16(cpu.sp);
+		wr16(cpu.sp, get_rp(2, index));
+		set_rp(2, v, index);
+		return t + 19;
+	    }
+	    case 5: {
+		word de = DE;
+		SET_DE(HL);
+		SET_HL(de);
+		return t + 4;
+	    }
+	    case 6:
+		cpu.iff1 = cpu.iff2 = 0;
+		return t + 4;
+	    default:
+		cpu.iff1 = cpu.iff2 = 1;
+		cpu.after_ei = 1;
+		return t + 4;
+	    }
+	case 4: {
+	    word nn = fetch16();
+	    if (condition(y)) {
+		push(cpu.pc);
+		cpu.pc = nn;
+		return t + 17;
+	    }
+	    return t + 10;
+	}
+	case 5:
+	    if (q == 0) {
+		push(p == 3 ? (cpu.a << 8) | cpu.f : get_rp(p, index));
+		return t + 11;
+	    }
+	    if (p == 0) {
+		word nn = fetch16();
+		push(cpu.pc);
+		cpu.pc = nn;
+		return t + 17;
+	    }
+	    return t + execute_ed();
+	case 6:
+	    alu(y, fetch());
+	    return t + 7;
+	default:
+	    push(cpu.pc);
+	    cpu.pc = y << 3;
+	    return t + 11;
+	}
+    }
+}
+
+/* one instruction with its contention, returns T-states */
+static int step(void) {
+    offset = stall = 0;
+    cpu.after_ei = 0;
+    int t = execute() + stall;
+    cpu.cycles += t;
+    return t;
+}
+
+/* maskable interrupt, IM 2 reads the vector at I:0xff */
+static int interrupt(void) {
+    if (!cpu.iff1 || cpu.after_ei) return 0;
+    offset = stall = 0;
+    if (cpu.halted) {
+	cpu.halted = 0;
+	cpu.pc++;
+    }
+    cpu.iff1 = cpu.iff2 = 0;
+    cpu.r++;
+    offset = 7;
+    push(cpu.pc);
+    int t = cpu.im == 2 ? 19 : 13;
+    if (cpu.im == 2) cpu.pc = rd16((cpu.i << 8) | 0xff);
+    else cpu.pc = 0x38;
+    cpu.cycles += t + stall;
+    return t + stall;
+}
+
+/* benchmark: bench.c sends a name to port 0xfd and brackets each
+ * kernel with two writes to port 0xff, the first pair is empty and
+ * gives the overhead of the brackets themselves */
+
+#define MAX_BENCH	64
+#define LIMIT		4000000000ULL
+
+struct Result {
+    char name[32];
+    unsigned long long cycles;
+    int bytes;
+    int out;
+};
+
+static struct Result results[MAX_BENCH];
+static int count;
+static int running;
+static char name[32];
+static unsigned long long started;
+static byte touched[0x10000];
+static byte written[0x10000];
+static word bench_sp;
+
+/* bytes written outside the stack frames under SP at the start mark */
+static int output_bytes(void) {
+    int out = 0;
+    for (int i = 0; i < sizeof(written); i++) {
+	if (i >= bench_sp - 256 && i < bench_sp) continue;
+	out += written[i];
+    }
+    return out;
+}
+
+static void bench_out(word port, byte data) {
+    switch (port & 0xff) {
+    case 0xfd: {
+	int n = strlen(name);
+	if (n + 1 < sizeof(name)) name[n] = data;
+	break;
+    }
+    case 0xff:
+	if (!running) {
+	    memset(touched, 0, sizeof(touched));
+	    memset(written, 0, sizeof(written));
+	    code_map = touched;
+	    write_map = written;
+	    bench_sp = cpu.sp;
+	    started = cpu.cycles;
+	}
+	else if (count < MAX_BENCH) {
+	    struct Result *result = results + count++;
+	    int bytes = 0;
+	    for (int i = 0; i < sizeof(touched); i++) bytes += touched[i];
+	    strcpy(result->name, name);
+	    result->cycles = cpu.cycles - started;
+	    result->bytes = bytes;
+	    result->out = output_bytes();
+	    memset(name, 0, sizeof(name));
+	    code_map = NULL;
+	    write_map = NULL;
+	}
+	running = !running;
+	break;
+    }
+}
+
+static int load_binary(const char *file, int origin) {
+    FILE *f = fopen(file, "r");
+    if (f == NULL) return -ENOENT;
+    int size = fread(memory + origin, 1, sizeof(memory) - origin, f);
+    fclose(f);
+    return size;
+}
+
+static int compare(const char *file, int update) {
+    int failed = 0;
+    FILE *f = update ? NULL : fopen(file, "r");
+    struct Result *base = results;
+    for (int i = 1; i < count; i++) {
+	struct Result *now = results + i;
+	unsigned long long cycles = now->cycles - base->cycles;
+	int bytes = now->bytes - base->bytes;
+	unsigned long long old_cycles = 0;
+	int old_bytes = 0;
+	char line[128], old[32];
+	if (f != NULL) {
+	    rewind(f);
+	    while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%31s %llu %d", old, &old_cycles, &old_bytes) == 3
+		    && strcmp(old, now->name) == 0) break;
+		old_cycles = 0;
+	    }
+	}
+	printf("BENCH:%s T:%llu BYTES:%d", now->name, cycles, bytes);
+	if (now->out > 0) {
+	    printf(" OUT:%d T/OUT:%.1f", now->out, (double) cycles / now->out);
+	}
+	if (old_cycles > 0) {
+	    printf(" BASE:%llu", old_cycles);
+	    if (cycles > old_cycles || bytes > old_bytes) {
+		printf(" REGRESSION");
+		failed = 1;
+	    }
+	}
+	printf("\n");
+    }
+    if (f != NULL) {
+	fclose(f);
+	return failed;
+    }
+    if (!update) {
+	fprintf(stderr, "ERROR: no baseline %s, make bench-update\n", file);
+	return -ENOENT;
+    }
+    f = fopen(file, "w");
+    if (f == NULL) return -EIO;
+    for (int i = 1; i < count; i++) {
+	fprintf(f, "%s %llu %d\n", results[i].name,
+		results[i].cycles - base->cycles,
+		results[i].bytes - base->bytes);
+    }
+    fclose(f);
+    fprintf(stderr, "BASELINE:%s\n", file);
+    return 0;
+}
+
+static int bench(char **argv, int update) {
+    int origin = strtol(argv[1], NULL, 0);
+    if (load_binary(argv[0], origin) < 0) {
+	fprintf(stderr, "ERROR: cannot read %s\n", argv[0]);
+	return -ENOENT;
+    }
+    cpu.pc = strtol(argv[2], NULL, 0);
+    port_out = &bench_out;
+    while (!cpu.halted && cpu.cycles < LIMIT) step();
+    if (!cpu.halted || count < 1) {
+	fprintf(stderr, "ERROR: benchmark did not finish\n");
+	return -ETIME;
+    }
+    return compare(argv[3], update);
+}
+
+/* profile: the game itself on a 48K Spectrum with frame interrupts,
+ * ULA contention on 0x4000-0x7fff while the beam is in the display
+ * and space held for a few frames every second; game_loop of the
+ * PROFILE build names its phases on port 0xfb */
+
+#define FRAME_T		69888
+#define DISPLAY_T	14335
+#define LINE_T		224
+
+static const char *phases[] = {
+    "other", "wait", "player", "emit", "field", "next",
+};
+
+#define PHASES	(sizeof(phases) / sizeof(*phases))
+
+struct Phase {
+    unsigned long long cycles;
+    unsigned long long stall;
+    unsigned long long frame;
+    unsigned long long peak;
+};
+
+static struct Phase phase[PHASES];
+static int current_phase;
+static unsigned long long screen_stall;
+static unsigned long long attr_stall;
+static unsigned long long other_stall;
+static int frame;
+static word lowest;
+static word stack_floor;
+static int cold_base, cold_end;
+static void (*frame_hook)(void);
+
+/* the cold overlay unpacked to [cold_base, cold_end) is contended by
+ * design and is left out of the other stall */
+static int ula_delay(word addr, unsigned long long when) {
+    static const byte delay[] = { 6, 5, 4, 3, 2, 1, 0, 0 };
+    int t = (int) (when % FRAME_T) - DISPLAY_T;
+    if ((addr & 0xc000) != 0x4000) return 0;
+    if (t < 0 || t >= 192 * LINE_T || t % LINE_T >= 128) return 0;
+    int n = delay[t & 7];
+    if (addr < 0x5800) screen_stall += n;
+    else if (addr < 0x5b00) attr_stall += n;
+    else if (addr < cold_base || addr >= cold_end) other_stall += n;
+    return n;
+}
+
+static void profile_out(word port, byte data) {
+    if ((port & 0xff) == 0xfb && data < PHASES) current_phase = data;
+}
+
+static byte profile_in(word port) {
+    int space = frame % 50 < 5;
+    if (port & 1) return 0xff;
+    return space && !(port & 0x8000) ? 0xfe : 0xff;
+}
+
+static void end_frame(void) {
+    if (frame_hook) frame_hook();
+    for (int i = 0; i < PHASES; i++) {
+	if (phase[i].frame > phase[i].peak) phase[i].peak = phase[i].frame;
+	phase[i].frame = 0;
+    }
+    frame++;
+}
+
+static void run_game(int frames) {
+    unsigned long long frame_end = FRAME_T;
+    if (port_out == NULL) port_out = &profile_out;
+    if (port_in == NULL) port_in = &profile_in;
+    contention = &ula_delay;
+    lowest = cpu.sp;
+    while (frame < frames) {
+	struct Phase *now = phase + current_phase;
+	int t = cpu.cycles % FRAME_T < 32 ? interrupt() : 0;
+	if (t == 0) t = step();
+	/* SP below the band is a block fill using the stack */
+	if (cpu.sp < lowest && cpu.sp >= stack_floor) lowest = cpu.sp;
+	now->cycles += t;
+	now->stall += stall;
+	now->frame += t;
+	if (cpu.cycles >= frame_end) {
+	    frame_end += FRAME_T;
+	    end_frame();
+	}
+    }
+}
+
+static int profile(char **argv) {
+    int origin = strtol(argv[1], NULL, 0);
+    if (load_binary(argv[0], origin) < 0) {
+	fprintf(stderr, "ERROR: cannot read %s\n", argv[0]);
+	return -ENOENT;
+    }
+    int frames = atoi(argv[3]);
+    if (argv[4] && argv[5]) {
+	cold_base = strtol(argv[4], NULL, 0);
+	cold_end = cold_base + atoi(argv[5]);
+    }
+    cpu.pc = strtol(argv[2], NULL, 0);
+    run_game(frames);
+    for (int i = 0; i < PHASES; i++) {
+	if (phase[i].cycles == 0) continue;
+	printf("PHASE:%s T:%llu STALL:%llu PEAK:%llu\n", phases[i],
+	       phase[i].cycles / frames, phase[i].stall / frames,
+	       phase[i].peak);
+    }
+    printf("FRAMES:%d SCREEN:%llu ATTR:%llu OTHER:%llu\n", frames,
+	   screen_stall / frames, attr_stall / frames, other_stall / frames);
+    if (other_stall > 0) {
+	fprintf(stderr, "WARNING: code, data or stack in contended RAM\n");
+    }
+    return 0;
+}
+
+/* stack: the same run with RAM above the program painted, the stack
+ * reaches down to the lowest SP or to the lowest repainted byte under
+ * stack top, whichever is deeper; data below it ends the scan, SP
+ * outside the painted band is not a call stack and is not counted */
+
+#define PAINT		0xa5
+#define CLEAN		32
+
+static int stack(char **argv) {
+    int origin = strtol(argv[1], NULL, 0);
+    int top = strtol(argv[4], NULL, 0);
+    memset(memory, PAINT, sizeof(memory));
+    int size = load_binary(argv[0], origin);
+    if (size < 0) {
+	fprintf(stderr, "ERROR: cannot read %s\n", argv[0]);
+	return -ENOENT;
+    }
+    cpu.pc = strtol(argv[2], NULL, 0);
+    cpu.sp = top;
+    stack_floor = origin + size;
+    run_game(atoi(argv[3]));
+
+    int low = lowest;
+    int clean = 0;
+    for (int i = top - 1; i >= origin + size && clean < CLEAN; i--) {
+	if (memory[i] == PAINT) {
+	    clean++;
+	}
+	else {
+	    if (i < low) low = i;
+	    clean = 0;
+	}
+    }
+    printf("STACK:0x%04x LOW:0x%04x DEPTH:%d\n", top, low, top - low);
+    return 0;
+}
+
+/* heatmap: the same run counting every access, name.csv lists the
+ * touched addresses and name.tga is the 256x192 screen, bitmap reads
+ * and writes from black through red and yellow to white on a log
+ * scale, attribute accesses tint their cell blue */
+
+static struct Heat counts[0x10000];
+
+static int log_scale(unsigned long long n) {
+    int bits = 0;
+    while (n >> bits > 1) bits++;
+    return n ? 16 * bits + ((n << 4 >> bits) & 15) + 1 : 0;
+}
+
+static byte ramp(int level, int from) {
+    int n = 3 * level - from;
+    return n < 0 ? 0 : n > 255 ? 255 : n;
+}
+
+static word screen_addr(int x, int y) {
+    return 0x4000 | ((y & 0xc0) << 5) | ((y & 7) << 8) | ((y & 0x38) << 2)
+	| (x >> 3);
+}
+
+static int save_heat(const char *name) {
+    char file[256];
+    snprintf(file, sizeof(file), "%s.csv", name);
+    FILE *f = fopen(file, "w");
+    if (f == NULL) return -EIO;
+    fprintf(f, "address,read,write,exec\n");
+    for (int i = 0; i < 0x10000; i++) {
+	struct Heat *h = counts + i;
+	if (h->read + h->write + h->exec == 0) continue;
+	fprintf(f, "0x%04x,%u,%u,%u\n", i, h->read, h->write, h->exec);
+    }
+    fclose(f);
+
+    int top = 1;
+    for (int i = 0x4000; i < 0x5b00; i++) {
+	int level = log_scale(counts[i].read + counts[i].write);
+	if (level > top) top = level;
+    }
+    snprintf(file, sizeof(file), "%s.tga", name);
+    f = fopen(file, "w");
+    if (f == NULL) return -EIO;
+    byte header[18] = { 0, 0, 2 };
+    header[12] = 256 & 0xff;
+    header[13] = 256 >> 8;
+    header[14] = 192;
+    header[16] = 24;
+    header[17] = 0x20;
+    fwrite(header, 1, sizeof(header), f);
+    for (int y = 0; y < 192; y++) {
+	for (int x = 0; x < 256; x++) {
+	    struct Heat *h = counts + screen_addr(x, y);
+	    struct Heat *a = counts + 0x5800 + ((y >> 3) << 5) + (x >> 3);
+	    int level = 255 * log_scale(h->read + h->write) / top;
+	    int tint = 127 * log_scale(a->read + a->write) / top;
+	    byte b = ramp(level, 510);
+	    byte pixel[3] = { b > tint ? b : tint, ramp(level, 255),
+			      ramp(level, 0) };
+	    fwrite(pixel, 1, sizeof(pixel), f);
+	}
+    }
+    fclose(f);
+    return 0;
+}
+
+static int heatmap(char **argv) {
+    int origin = strtol(argv[1], NULL, 0);
+    if (load_binary(argv[0], origin) < 0) {
+	fprintf(stderr, "ERROR: cannot read %s\n", argv[0]);
+	return -ENOENT;
+    }
+    cpu.pc = strtol(argv[2], NULL, 0);
+    heat = counts;
+    run_game(atoi(argv[3]));
+    heat = NULL;
+    if (save_heat(argv[4]) < 0) {
+	fprintf(stderr, "ERROR: cannot write %s\n", argv[4]);
+	return -EIO;
+    }
+    fprintf(stderr, "HEAT:%s.csv IMAGE:%s.tga\n", argv[4], argv[4]);
+    return 0;
+}
+
+/* soak: many runs of the PROFILE build at once, one process per run
+ * and at most one per core, each pressing space on its own schedule:
+ * random taps from a seed or "start frames" lines of a script file.
+ * game_loop sends live rays, level and die on port 0xf9 every frame.
+ * A run reports its longest frame from vblank to the next wait, peak
+ * rays, deaths per level and a chained screen hash, checkpointed every
+ * CHECK_EVERY frames and compared with the baseline */
+
+#define MAX_RUNS	256
+#define MAX_LEVELS	16
+#define MAX_CHECKS	64
+#define MAX_PRESSES	8192
+#define CHECK_EVERY	256
+
+struct Press {
+    int start;
+    int hold;
+};
+
+struct Soak {
+    char name[64];
+    int seed;
+    int done;
+    unsigned long long worst;
+    int worst_frame;
+    int over;
+    int peak;
+    int reached;
+    int deaths[MAX_LEVELS];
+    int peaks[MAX_LEVELS];
+    int checks;
+    unsigned long long check[MAX_CHECKS];
+    unsigned long long hash;
+};
+
+static struct Soak *run;
+static struct Press presses[MAX_PRESSES];
+static int press_count;
+static int press_next;
+static unsigned long long left_wait;
+static byte state[3];
+static int states;
+static byte last_die;
+
+static void seed_presses(unsigned seed, int frames) {
+    press_count = 0;
+    for (int at = 0; at < frames && press_count < MAX_PRESSES; ) {
+	struct Press *press = presses + press_count++;
+	seed = seed * 1103515245 + 12345;
+	at += 1 + (seed >> 16) % 48;
+	seed = seed * 1103515245 + 12345;
+	press->start = at;
+	press->hold = 1 + (seed >> 16) % 6;
+	at += press->hold;
+    }
+}
+
+static int read_script(const char *file) {
+    char line[128];
+    FILE *f = fopen(file, "r");
+    if (f == NULL) return -ENOENT;
+    press_count = 0;
+    while (fgets(line, sizeof(line), f) != NULL
+	   && press_count < MAX_PRESSES) {
+	struct Press *press = presses + press_count;
+	if (sscanf(line, "%d %d", &press->start, &press->hold) == 2) {
+	    press_count++;
+	}
+    }
+    fclose(f);
+    return 0;
+}
+
+static byte soak_in(word port) {
+    while (press_next < press_count
+	   && frame >= presses[press_next].start + presses[press_next].hold) {
+	press_next++;
+    }
+    int space = press_next < press_count
+	&& frame >= presses[press_next].start;
+    if (port & 1) return 0xff;
+    return space && !(port & 0x8000) ? 0xfe : 0xff;
+}
+
+static void soak_state(void) {
+    byte rays = state[0], die = state[2];
+    int level = state[1] < MAX_LEVELS ? state[1] : MAX_LEVELS - 1;
+    if (rays > run->peak) run->peak = rays;
+    if (rays > run->peaks[level]) run->peaks[level] = rays;
+    if (level >= run->reached) run->reached = level + 1;
+    if (die && !last_die) run->deaths[level]++;
+    last_die = die;
+}
+
+/* frames run from leaving the wait to the next wait, OTHER ends one */
+static void soak_out(word port, byte data) {
+    switch (port & 0xff) {
+    case 0xfb:
+	if (data == 1 && left_wait) {
+	    unsigned long long busy = cpu.cycles - left_wait;
+	    if (busy > run->worst) {
+		run->worst = busy;
+		run->worst_frame = frame;
+	    }
+	    if (busy >= FRAME_T) run->over++;
+	}
+	if (current_phase == 1 && data != 1) left_wait = cpu.cycles;
+	if (data == 0) left_wait = 0;
+	profile_out(port, data);
+	break;
+    case 0xf9:
+	state[states++] = data;
+	if (states == 3) {
+	    soak_state();
+	    states = 0;
+	}
+	break;
+    }
+}
+
+static void soak_frame(void) {
+    for (int i = 0x4000; i < 0x5b00; i++) {
+	run->hash = (run->hash ^ memory[i]) * 0x100000001b3ULL;
+    }
+    if ((frame + 1) % CHECK_EVERY == 0 && run->checks < MAX_CHECKS) {
+	run->check[run->checks++] = run->hash;
+    }
+}
+
+static int soak_run(struct Soak *soak, int frames) {
+    run = soak;
+    if (soak->seed) {
+	seed_presses(soak->seed, frames);
+    }
+    else if (read_script(soak->name) < 0) {
+	fprintf(stderr, "ERROR: cannot read %s\n", soak->name);
+	return -ENOENT;
+    }
+    run->hash = 0xcbf29ce484222325ULL;
+    port_out = &soak_out;
+    port_in = &soak_in;
+    frame_hook = &soak_frame;
+    run_game(frames);
+    run->done = 1;
+    return 0;
+}
+
+static int finish_run(void) {
+    int status;
+    wait(&status);
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+static int run_all(struct Soak *soaks, int count, int frames) {
+    int error = 0, running = 0;
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < count; i++) {
+	if (running == cores) {
+	    error |= finish_run();
+	    running--;
+	}
+	fflush(stdout);
+	if (fork() == 0) exit(soak_run(soaks + i, frames) ? 1 : 0);
+	running++;
+    }
+    while (running-- > 0) error |= finish_run();
+    return error;
+}
+
+static int add_seeds(struct Soak *soaks, int count, int n) {
+    for (; n > 0 && count < MAX_RUNS; n--, count++) {
+	soaks[count].seed = count + 1;
+	sprintf(soaks[count].name, "seed-%d", count + 1);
+    }
+    return count;
+}
+
+/* baseline lines: name frames hash check..., returns the first frame
+ * whose checkpoint differs or the last frame */
+static int diverged(struct Soak *soak, FILE *f, int frames) {
+    char line[2048], old[64];
+    int old_frames, n;
+    rewind(f);
+    while (fgets(line, sizeof(line), f) != NULL) {
+	if (sscanf(line, "%63s %d%n", old, &old_frames, &n) != 2
+	    || strcmp(old, soak->name) != 0 || old_frames != frames) continue;
+	char *ptr = line + n;
+	unsigned long long hash = strtoull(ptr, &ptr, 16);
+	if (hash == soak->hash) return 0;
+	for (int i = 0; i < soak->checks; i++) {
+	    if (strtoull(ptr, &ptr, 16) != soak->check[i]) {
+		return (i + 1) * CHECK_EVERY;
+	    }
+	}
+	return frames;
+    }
+    return 0;
+}
+
+static int save_soak(struct Soak *soaks, int count, const char *file,
+		     int frames) {
+    FILE *f = fopen(file, "w");
+    if (f == NULL) return -EIO;
+    for (int i = 0; i < count; i++) {
+	fprintf(f, "%s %d %016llx", soaks[i].name, frames, soaks[i].hash);
+	for (int j = 0; j < soaks[i].checks; j++) {
+	    fprintf(f, " %016llx", soaks[i].check[j]);
+	}
+	fprintf(f, "\n");
+    }
+    fclose(f);
+    fprintf(stderr, "BASELINE:%s\n", file);
+    return 0;
+}
+
+static int soak(int argc, char **argv) {
+    int origin = strtol(argv[1], NULL, 0);
+    if (load_binary(argv[0], origin) < 0) {
+	fprintf(stderr, "ERROR: cannot read %s\n", argv[0]);
+	return -ENOENT;
+    }
+    cpu.pc = strtol(argv[2], NULL, 0);
+    int frames = atoi(argv[3]);
+    const char *baseline = argv[4];
+
+    int count = 0, update = 0;
+    struct Soak *soaks = mmap(NULL, MAX_RUNS * sizeof(struct Soak),
+			      PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (soaks == MAP_FAILED) return -ENOMEM;
+    for (int i = 5; i < argc; i++) {
+	if (strcmp(argv[i], "-u") == 0) {
+	    update = 1;
+	}
+	else if (atoi(argv[i]) > 0) {
+	    count = add_seeds(soaks, count, atoi(argv[i]));
+	}
+	else if (count < MAX_RUNS) {
+	    snprintf(soaks[count++].name, 64, "%s", argv[i]);
+	}
+    }
+    if (count == 0) {
+	count = add_seeds(soaks, count, sysconf(_SC_NPROCESSORS_ONLN));
+    }
+    if (run_all(soaks, count, frames)) {
+	fprintf(stderr, "ERROR: soak run failed\n");
+	return -ECHILD;
+    }
+
+    FILE *f = update ? NULL : fopen(baseline, "r");
+    int levels = 0, over = 0, peak = 0, deaths = 0, divergences = 0;
+    struct Soak *worst = soaks;
+    for (int i = 0; i < count; i++) {
+	struct Soak *s = soaks + i;
+	int died = 0;
+	for (int l = 0; l < MAX_LEVELS; l++) died += s->deaths[l];
+	printf("RUN:%s WORST:%llu FRAME:%d OVER:%d PEAK:%d "
+	       "LEVELS:%d DEATHS:%d\n", s->name, s->worst, s->worst_frame,
+	       s->over, s->peak, s->reached, died);
+	if (s->worst > worst->worst) worst = s;
+	if (s->reached > levels) levels = s->reached;
+	if (s->peak > peak) peak = s->peak;
+	over += s->over;
+	deaths += died;
+	int at = f ? diverged(s, f, frames) : 0;
+	if (at > 0) {
+	    printf("DIVERGED:%s FRAME:%d\n", s->name, at);
+	    divergences++;
+	}
+    }
+    for (int l = 0; l < levels; l++) {
+	int runs = 0, died = 0, most = 0;
+	for (int i = 0; i < count; i++) {
+	    if (soaks[i].reached > l) runs++;
+	    died += soaks[i].deaths[l];
+	    if (soaks[i].peaks[l] > most) most = soaks[i].peaks[l];
+	}
+	printf("LEVEL:%d RUNS:%d DEATHS:%d PEAK:%d\n", l, runs, died, most);
+    }
+    printf("RUNS:%d FRAMES:%d WORST:%llu IN:%s OVER:%d PEAK:%d "
+	   "DEATHS:%d DIVERGED:%d\n", count, frames, worst->worst,
+	   worst->name, over, peak, deaths, divergences);
+    if (f != NULL) {
+	fclose(f);
+	return divergences > 0;
+    }
+    if (!update) {
+	fprintf(stderr, "ERROR: no baseline %s, make soak-update\n", baseline);
+	return -ENOENT;
+    }
+    return save_soak(soaks, count, baseline, frames);
+}
+
+int main(int argc, char **argv) {
+    init_tables();
+    if (argc > 5 && strcmp(argv[1], "-b") == 0) {
+	return bench(argv + 2, argc > 6 && strcmp(argv[6], "-u") == 0);
+    }
+    if (argc > 5 && strcmp(argv[1], "-p") == 0) {
+	return profile(argv + 2);
+    }
+    if (argc > 6 && strcmp(argv[1], "-s") == 0) {
+	return stack(argv + 2);
+    }
+    if (argc > 6 && strcmp(argv[1], "-m") == 0) {
+	return heatmap(argv + 2);
+    }
+    if (argc > 6 && strcmp(argv[1], "-r") == 0) {
+	return soak(argc - 2, argv + 2);
+    }
+    printf("USAGE: z80-sim -b program.bin origin entry baseline [-u]\n");
+    printf("       z80-sim -p program.bin origin entry frames "
+	   "[cold size]\n");
+    printf("       z80-sim -s program.bin origin entry frames top\n");
+    printf("       z80-sim -m program.bin origin entry frames name\n");
+    printf("       z80-sim -r program.bin origin entry frames baseline "
+	   "[runs] [script ...] [-u]\n");
+    printf("  -b   run bench entry point, compare against baseline\n");
+    printf("  -u   rewrite baseline instead of comparing\n");
+    printf("  -p   run the game as a contended 48K Spectrum, time phases,\n");
+    printf("       stalls in the cold overlay at cold are not counted\n");
+    printf("  -s   same run, stack high-water below stack top\n");
+    printf("  -m   same run, access counts to name.csv and name.tga\n");
+    printf("  -r   same run seeded or scripted on every core, worst frame,\n");
+    printf("       rays, deaths per level and screen hashes vs baseline\n");
+    return 0;
+}
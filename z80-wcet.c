@@ -0,0 +1,787 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+
+/* worst case T-states over sdcc's .asm output
+ *
+ * Loop bounds come from the source lines sdcc copies into the .asm:
+ * for (v = A; v < B; v += S) headers are counted, any other loop needs
+ * a comment on its first line:
+ *   wcet: N      at most N iterations
+ *   wcet: idle   waits for vsync, the wait belongs to the last frame
+ *   wcet: frame  one iteration is one frame, checked against the budget
+ * and wcet: skip on a function definition leaves it out of the graph. */
+
+#define MAX_LINES	65536
+#define MAX_FUNCS	512
+#define MAX_CALLS	32
+#define MAX_EDGES	4
+#define EXIT		-1
+#define IDLE		0
+#define FRAME		-2
+#define UNKNOWN		-3
+
+struct Item {
+    char label[64];
+    char op[16];
+    char arg[2][64];
+    int args;
+    int line;
+    char *source;
+};
+
+struct Call {
+    int func;
+    int count;
+    long long cost;
+};
+
+struct Edge {
+    int to;
+    int func;
+    long long cost;
+};
+
+struct Node {
+    int first, last;
+    long long cost;
+    struct Edge edge[MAX_EDGES];
+    int edges;
+    int alive;
+    struct Call call[MAX_CALLS];
+    int calls;
+};
+
+struct Func {
+    char name[64];
+    int first, last;
+    int skip;
+    int taken;
+    int state;
+    long long wcet;
+    struct Call call[MAX_CALLS];
+    int calls;
+};
+
+static struct Item items[MAX_LINES];
+static int item_count;
+static struct Func funcs[MAX_FUNCS];
+static int func_count;
+static int unbounded;
+
+static long long frame_cost = -1;
+static struct Call frame_call[MAX_CALLS];
+static int frame_calls;
+static char frame_func[64];
+
+static long long wcet(int f);
+
+static char *trim(char *s) {
+    while (isspace(*s)) s++;
+    int n = strlen(s);
+    while (n > 0 && isspace(s[n - 1])) s[--n] = 0;
+    return s;
+}
+
+static void lower(char *s) {
+    for (; *s; s++) *s = tolower(*s);
+}
+
+static int find_func(const char *label) {
+    for (int i = 0; i < func_count; i++) {
+	if (strcmp(funcs[i].name, label) == 0) return i;
+    }
+    return -1;
+}
+
+/* sdcc prints ";main.c:338: while (i != head) {" before the code */
+static void parse_source(char *text, int *line, char **source) {
+    char *colon = strchr(text, ':');
+    if (colon == NULL || strstr(text, ".c:") == NULL) return;
+    *line = atoi(colon + 1);
+    char *rest = strchr(colon + 1, ':');
+    *source = strdup(rest ? trim(rest + 1) : "");
+}
+
+static void read_asm(FILE *f) {
+    char buf[512];
+    int line = 0;
+    char *source = "";
+    struct Func *func = NULL;
+    char *pending = "";
+    while (fgets(buf, sizeof(buf), f) != NULL && item_count < MAX_LINES) {
+	char *s = buf;
+	if (*s == ';') {
+	    if (strncmp(s, "; Function ", 11) == 0 && func_count < MAX_FUNCS) {
+		if (func) func->last = item_count;
+		func = funcs + func_count++;
+		sprintf(func->name, "_%s", trim(s + 11));
+		func->first = item_count;
+		func->skip = strstr(pending, "wcet: skip") != NULL;
+	    }
+	    else {
+		parse_source(s + 1, &line, &source);
+		if (strstr(s, ".c:")) pending = source;
+	    }
+	    continue;
+	}
+	char *comment = strchr(s, ';');
+	if (comment) *comment = 0;
+	if (strncmp(trim(s), ".area", 5) == 0 && func) {
+	    func->last = item_count;
+	    func = NULL;
+	}
+	struct Item *item = items + item_count;
+	memset(item, 0, sizeof(*item));
+	item->line = line;
+	item->source = source;
+	char *colon = strchr(s, ':');
+	if (!isspace(*s) && colon) {
+	    *colon = 0;
+	    snprintf(item->label, sizeof(item->label), "%s", trim(s));
+	    s = colon + 1;
+	    if (*s == ':') s++;
+	    item_count++;
+	    item = items + item_count;
+	    memset(item, 0, sizeof(*item));
+	    item->line = line;
+	    item->source = source;
+	}
+	s = trim(s);
+	if (*s == 0) continue;
+	if (*s == '.') {
+	    /* .dw _emit_whirler in level_list takes the address */
+	    if (strncmp(s, ".dw", 3) == 0) {
+		snprintf(item->arg[0], sizeof(item->arg[0]), "%s", trim(s + 3));
+		strcpy(item->op, ".dw");
+		item_count++;
+	    }
+	    continue;
+	}
+	int n = 0;
+	while (*s && !isspace(*s) && n < 15) item->op[n++] = tolower(*s++);
+	char *arg = trim(s);
+	for (int i = 0; i < 2 && *arg; i++) {
+	    char *end = arg;
+	    int depth = 0;
+	    while (*end && (depth || *end != ',')) {
+		if (*end == '(') depth++;
+		if (*end == ')') depth--;
+		end++;
+	    }
+	    if (*end) *end++ = 0;
+	    snprintf(item->arg[i], sizeof(item->arg[i]), "%s", trim(arg));
+	    item->args = i + 1;
+	    arg = trim(end);
+	}
+	item_count++;
+    }
+    if (func) func->last = item_count;
+}
+
+/* the address of any function named in #_name or .dw _name is taken */
+static void find_taken(void) {
+    for (int i = 0; i < item_count; i++) {
+	for (int j = 0; j < items[i].args; j++) {
+	    char *arg = items[i].arg[j];
+	    int f = find_func(arg[0] == '#' ? arg + 1 : arg);
+	    if (f >= 0 && (arg[0] == '#' || strcmp(items[i].op, ".dw") == 0)) {
+		funcs[f].taken = 1;
+	    }
+	}
+    }
+}
+
+enum { R, X8, RR, XX, M, MX, MBC, MSP, MN, PC, N, SPECIAL };
+
+static int kind(const char *arg) {
+    char s[64];
+    snprintf(s, sizeof(s), "%s", arg);
+    lower(s);
+    if (strlen(s) == 1 && strchr("abcdehl", s[0])) return R;
+    if (!strcmp(s, "i") || !strcmp(s, "r")) return SPECIAL;
+    if (!strncmp(s, "ix", 2) || !strncmp(s, "iy", 2)) {
+	return strlen(s) == 2 ? XX : X8;
+    }
+    if (!strcmp(s, "bc") || !strcmp(s, "de") || !strcmp(s, "hl")
+	|| !strcmp(s, "sp") || !strcmp(s, "af")) return RR;
+    if (!strcmp(s, "af'")) return RR;
+    if (strstr(s, "(ix") || strstr(s, "(iy")) return MX;
+    if (!strcmp(s, "(hl)")) return M;
+    if (!strcmp(s, "(bc)") || !strcmp(s, "(de)")) return MBC;
+    if (!strcmp(s, "(sp)")) return MSP;
+    if (!strcmp(s, "(c)")) return PC;
+    if (s[0] == '(') return MN;
+    return N;
+}
+
+static int is_condition(const char *arg) {
+    static const char *cc[] = { "z", "nz", "c", "nc", "po", "pe", "p", "m" };
+    char s[8];
+    snprintf(s, sizeof(s), "%s", arg);
+    lower(s);
+    for (int i = 0; i < 8; i++) {
+	if (strcmp(s, cc[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static int is_alu(const char *op) {
+    static const char *alu[] = {
+	"add", "adc", "sub", "sbc", "and", "xor", "or", "cp"
+    };
+    for (int i = 0; i < 8; i++) {
+	if (strcmp(op, alu[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static int is_shift(const char *op) {
+    static const char *shift[] = {
+	"rlc", "rrc", "rl", "rr", "sla", "sra", "sll", "srl", "set", "res"
+    };
+    for (int i = 0; i < 10; i++) {
+	if (strcmp(op, shift[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static int by_operand(int k, int r, int x8, int m, int mx) {
+    if (k == M) return m;
+    if (k == MX) return mx;
+    if (k == X8) return x8;
+    return r;
+}
+
+/* T-states of one instruction, taken is the cost of a taken branch */
+static int cost(struct Item *item, int *taken) {
+    const char *op = item->op;
+    int a = item->args > 0 ? kind(item->arg[0]) : -1;
+    int b = item->args > 1 ? kind(item->arg[1]) : -1;
+    int cond = item->args > 0 && is_condition(item->arg[0]);
+    *taken = -1;
+
+    if (!strcmp(op, "ld")) {
+	if (a == R && b == R) return 4;
+	if ((a == R && b == X8) || (a == X8 && (b == R || b == X8))) return 8;
+	if (a == X8 && b == N) return 11;
+	if (a == R && b == N) return 7;
+	if ((a == R && b == M) || (a == M && b == R)) return 7;
+	if (a == MX || b == MX) return 19;
+	if (a == M && b == N) return 10;
+	if (a == MBC || b == MBC) return 7;
+	if (a == R && b == MN) return 13;
+	if (a == MN && b == R) return 13;
+	if (a == RR && b == N) return 10;
+	if (a == XX && b == N) return 14;
+	if (a == RR && b == MN) return strcasecmp(item->arg[0], "hl") ? 20 : 16;
+	if (a == MN && b == RR) return strcasecmp(item->arg[1], "hl") ? 20 : 16;
+	if (a == XX || b == XX) return (a == MN || b == MN) ? 20 : 10;
+	if (a == RR && b == RR) return 6;
+	return 9;
+    }
+    if (!strcmp(op, "push")) return a == XX ? 15 : 11;
+    if (!strcmp(op, "pop")) return a == XX ? 14 : 10;
+    if (!strcmp(op, "ex")) {
+	if (a == MSP) return b == XX ? 23 : 19;
+	return 4;
+    }
+    if (is_alu(op)) {
+	if (a == RR && item->args == 2) {
+	    return strcmp(op, "add") ? 15 : 11;
+	}
+	if (a == XX) return 15;
+	int src = item->args == 2 ? b : a;
+	if (src == N) return 7;
+	return by_operand(src, 4, 8, 7, 19);
+    }
+    if (!strcmp(op, "inc") || !strcmp(op, "dec")) {
+	if (a == RR) return 6;
+	if (a == XX) return 10;
+	return by_operand(a, 4, 8, 11, 23);
+    }
+    if (is_shift(op)) return by_operand(item->args == 2 ? b : a, 8, 8, 15, 23);
+    if (!strcmp(op, "bit")) return by_operand(b, 8, 8, 12, 20);
+    if (!strcmp(op, "jp")) {
+	if (a == M) return 4;
+	if (a == MX) return 8;
+	return 10;
+    }
+    if (!strcmp(op, "jr")) {
+	*taken = 12;
+	return cond ? 7 : 12;
+    }
+    if (!strcmp(op, "djnz")) {
+	*taken = 13;
+	return 8;
+    }
+    if (!strcmp(op, "call")) return cond ? 10 : 17;
+    if (!strcmp(op, "ret")) return cond ? 5 : 10;
+    if (!strcmp(op, "reti") || !strcmp(op, "retn")) return 14;
+    if (!strcmp(op, "rst")) return 11;
+    if (!strcmp(op, "in") || !strcmp(op, "out")) {
+	return (a == PC || b == PC) ? 12 : 11;
+    }
+    if (!strcmp(op, "neg") || !strcmp(op, "im")) return 8;
+    if (!strcmp(op, "rld") || !strcmp(op, "rrd")) return 18;
+    if (strlen(op) == 3 && (!strncmp(op, "ld", 2) || !strncmp(op, "cp", 2))) {
+	return 16;
+    }
+    if (!strcmp(op, "ini") || !strcmp(op, "ind")) return 16;
+    if (!strcmp(op, "outi") || !strcmp(op, "outd")) return 16;
+    if (strlen(op) == 4 && op[3] == 'r') {
+	fprintf(stderr, "WARNING:%d: %s counted once\n", item->line, op);
+	return 21;
+    }
+    return 4;
+}
+
+static int is_jump(struct Item *item) {
+    const char *op = item->op;
+    return !strcmp(op, "jp") || !strcmp(op, "jr") || !strcmp(op, "djnz")
+	|| !strcmp(op, "ret") || !strcmp(op, "reti") || !strcmp(op, "retn")
+	|| !strcmp(op, "halt");
+}
+
+static const char *target(struct Item *item) {
+    return item->arg[item->args - 1];
+}
+
+static int is_word(const char *text, const char *at, int n) {
+    return (at == text || !isalnum(at[-1])) && !isalnum(at[n]) && at[n] != '_';
+}
+
+static int is_loop(const char *source) {
+    static const char *words[] = { "for", "while", "do", "wcet:" };
+    for (int i = 0; i < 4; i++) {
+	int n = strlen(words[i]);
+	for (const char *at = source; (at = strstr(at, words[i])); at += n) {
+	    if (is_word(source, at, n)) return 1;
+	}
+    }
+    return 0;
+}
+
+/* bound of a loop from its first source line, see the top of the file */
+static int loop_bound(int line, char *source) {
+    char *mark = strstr(source, "wcet:");
+    if (mark) {
+	mark = trim(mark + 5);
+	if (!strncmp(mark, "idle", 4)) return IDLE;
+	if (!strncmp(mark, "frame", 5)) return FRAME;
+	return atoi(mark);
+    }
+    char var[32], cmp[4], from[32], to[32];
+    int end = 0;
+    if (sscanf(source, " for ( %*s %31[a-z_0-9] = %31[0-9a-fx] ; %*s %2[<=]"
+	       " %31[0-9a-fx] ;%n", var, from, cmp, to, &end) == 4 && end > 0) {
+	long lo = strtol(from, NULL, 0);
+	long hi = strtol(to, NULL, 0) + (cmp[1] == '=' ? 1 : 0);
+	char *inc = strstr(source + end, "+=");
+	long by = inc ? strtol(trim(inc + 2), NULL, 0) : 1;
+	if (by > 0 && hi > lo) return (hi - lo + by - 1) / by;
+    }
+    fprintf(stderr, "UNBOUNDED:%d:%s\n", line, source);
+    unbounded = 1;
+    return UNKNOWN;
+}
+
+static void add_call(struct Call *list, int *count, int f, int n, long long t) {
+    for (int i = 0; i < *count; i++) {
+	if (list[i].func == f) {
+	    list[i].count += n;
+	    list[i].cost += t;
+	    return;
+	}
+    }
+    if (*count < MAX_CALLS) {
+	struct Call call = { f, n, t };
+	list[(*count)++] = call;
+    }
+}
+
+static long long indirect(int *worst) {
+    long long t = 0;
+    *worst = -1;
+    for (int i = 0; i < func_count; i++) {
+	if (funcs[i].taken && !funcs[i].skip && wcet(i) > t) {
+	    t = wcet(i);
+	    *worst = i;
+	}
+    }
+    return t;
+}
+
+static int label_node(struct Node *nodes, int count, const char *label) {
+    for (int i = 0; i < count; i++) {
+	if (!strcmp(items[nodes[i].first].label, label)) return i;
+    }
+    return EXIT;
+}
+
+/* split a function into basic blocks with edge costs */
+static int build_nodes(struct Func *func, struct Node *nodes) {
+    int count = 0;
+    for (int i = func->first; i < func->last; i++) {
+	if (items[i].label[0] || count == 0 || is_jump(items + i - 1)) {
+	    if (count > 0) nodes[count - 1].last = i;
+	    memset(nodes + count, 0, sizeof(*nodes));
+	    nodes[count].first = i;
+	    nodes[count].alive = 1;
+	    count++;
+	}
+    }
+    if (count > 0) nodes[count - 1].last = func->last;
+
+    for (int n = 0; n < count; n++) {
+	struct Node *node = nodes + n;
+	int fall = 1;
+	for (int i = node->first; i < node->last; i++) {
+	    struct Item *item = items + i;
+	    if (item->op[0] == 0 || item->op[0] == '.') continue;
+	    int taken, t = cost(item, &taken);
+	    if (!strcmp(item->op, "call")) {
+		int f = find_func(target(item));
+		if (f < 0) {
+		    fprintf(stderr, "WARNING:%d: call %s\n", item->line,
+			    target(item));
+		}
+		else if (!funcs[f].skip) {
+		    long long callee = wcet(f);
+		    t = 17 + callee;
+		    add_call(node->call, &node->calls, f, 1, t);
+		}
+	    }
+	    if (!is_jump(item)) {
+		node->cost += t;
+		continue;
+	    }
+	    const char *op = item->op;
+	    int cond = item->args > 0 && is_condition(item->arg[0]);
+	    struct Edge *edge = node->edge + node->edges++;
+	    edge->func = -1;
+	    fall = cond || !strcmp(op, "djnz");
+	    if (!strcmp(op, "jp") && item->args == 1 && kind(item->arg[0]) != N) {
+		int worst;
+		edge->to = EXIT;
+		edge->cost = t + indirect(&worst);
+		edge->func = worst;
+	    }
+	    else if (op[0] == 'r' || op[0] == 'h') {
+		edge->to = EXIT;
+		edge->cost = !strcmp(op, "ret") && cond ? 11 : t;
+	    }
+	    else {
+		int f = find_func(target(item));
+		edge->to = label_node(nodes, count, target(item));
+		edge->cost = taken > 0 ? taken : t;
+		if (edge->to == EXIT && f >= 0 && !funcs[f].skip) {
+		    edge->cost += wcet(f);
+		    edge->func = f;
+		}
+	    }
+	    if (fall) {
+		edge = node->edge + node->edges++;
+		edge->to = n + 1 < count ? n + 1 : EXIT;
+		edge->func = -1;
+		edge->cost = t;
+	    }
+	    fall = 0;
+	}
+	if (fall) {
+	    struct Edge *edge = node->edge + node->edges++;
+	    edge->to = n + 1 < count ? n + 1 : EXIT;
+	    edge->func = -1;
+	    edge->cost = 0;
+	}
+    }
+    return count;
+}
+
+/* longest path from node start over nodes in set, back edges to start
+ * excluded; dist[] ends up as cost up to and including each node */
+static void longest(struct Node *nodes, int count, int start, char *set,
+		    long long *dist, int *prev) {
+    for (int i = 0; i < count; i++) {
+	dist[i] = -1;
+	prev[i] = -1;
+    }
+    dist[start] = nodes[start].cost;
+    /* blocks only jump forward once loops are collapsed, except to start */
+    for (int pass = 0; pass < count; pass++) {
+	int changed = 0;
+	for (int n = 0; n < count; n++) {
+	    if (!set[n] || dist[n] < 0) continue;
+	    for (int e = 0; e < nodes[n].edges; e++) {
+		int to = nodes[n].edge[e].to;
+		if (to == EXIT || to == start || !set[to]) continue;
+		long long d = dist[n] + nodes[n].edge[e].cost + nodes[to].cost;
+		if (d > dist[to]) {
+		    dist[to] = d;
+		    prev[to] = n;
+		    changed = 1;
+		}
+	    }
+	}
+	if (!changed) break;
+    }
+}
+
+/* calls along the path ending in node end and leaving it by edge */
+static void path_calls(struct Node *nodes, int *prev, int end,
+		       struct Edge *edge, struct Call *list, int *calls,
+		       int times) {
+    for (int n = end; n >= 0; n = prev[n]) {
+	for (int i = 0; i < nodes[n].calls; i++) {
+	    struct Call *call = nodes[n].call + i;
+	    add_call(list, calls, call->func, call->count * times,
+		     call->cost * times);
+	}
+    }
+    if (edge && edge->func >= 0) {
+	add_call(list, calls, edge->func, times, edge->cost * times);
+    }
+}
+
+static int reaches(struct Node *nodes, int from, int to, int header,
+		   char *seen) {
+    if (from == to) return 1;
+    if (from == header || seen[from]) return 0;
+    seen[from] = 1;
+    for (int e = 0; e < nodes[from].edges; e++) {
+	int next = nodes[from].edge[e].to;
+	if (next != EXIT && reaches(nodes, next, to, header, seen)) return 1;
+    }
+    return 0;
+}
+
+/* collapse the loop at header into the header node */
+static void collapse(struct Func *func, struct Node *nodes, int count,
+		     int header, char *body) {
+    long long dist[count];
+    int prev[count];
+    int line = 0;
+    char *source = "";
+    /* the loop's own line is the earliest loop statement in it */
+    for (int n = 0; n < count; n++) {
+	if (!body[n]) continue;
+	for (int i = nodes[n].first; i < nodes[n].last; i++) {
+	    int at = items[i].line;
+	    if (at && (line == 0 || at < line) && is_loop(items[i].source)) {
+		line = at;
+		source = items[i].source;
+	    }
+	}
+    }
+    int bound = loop_bound(line, source);
+
+    longest(nodes, count, header, body, dist, prev);
+    long long round = 0;
+    int last = header;
+    for (int n = 0; n < count; n++) {
+	if (!body[n] || dist[n] < 0) continue;
+	for (int e = 0; e < nodes[n].edges; e++) {
+	    struct Edge *edge = nodes[n].edge + e;
+	    if (edge->to == header && dist[n] + edge->cost > round) {
+		round = dist[n] + edge->cost;
+		last = n;
+	    }
+	}
+    }
+    int times = bound > 0 ? bound : bound == UNKNOWN || bound == FRAME;
+    if (bound == FRAME) {
+	frame_cost = round;
+	frame_calls = 0;
+	path_calls(nodes, prev, last, NULL, frame_call, &frame_calls, 1);
+	snprintf(frame_func, sizeof(frame_func), "%s", func->name + 1);
+    }
+
+    /* leaving from a latch means the last pass never went back */
+    char latch[count];
+    memset(latch, 0, count);
+    for (int n = 0; n < count; n++) {
+	for (int e = 0; body[n] && e < nodes[n].edges; e++) {
+	    if (nodes[n].edge[e].to == header) latch[n] = 1;
+	}
+    }
+    struct Node loop = nodes[header];
+    loop.cost = 0;
+    loop.edges = 0;
+    loop.calls = 0;
+    long long out = -1;
+    int exit_node = header, rounds = times;
+    struct Edge *exit_edge = NULL;
+    for (int n = 0; n < count; n++) {
+	if (!body[n] || dist[n] < 0) continue;
+	for (int e = 0; e < nodes[n].edges; e++) {
+	    struct Edge *edge = nodes[n].edge + e;
+	    if (edge->to != EXIT && body[edge->to]) continue;
+	    int k = latch[n] && times > 0 ? times - 1 : times;
+	    long long t = k * round + dist[n] + edge->cost;
+	    if (t > out) {
+		out = t;
+		exit_node = n;
+		exit_edge = edge;
+		rounds = k;
+	    }
+	    int i;
+	    for (i = 0; i < loop.edges; i++) {
+		if (loop.edge[i].to == edge->to) break;
+	    }
+	    if (i == loop.edges) {
+		if (loop.edges == MAX_EDGES) {
+		    fprintf(stderr, "WARNING:%d: loop with many exits\n", line);
+		    i = MAX_EDGES - 1;
+		}
+		else {
+		    loop.edges++;
+		    loop.edge[i].cost = 0;
+		}
+	    }
+	    loop.edge[i].to = edge->to;
+	    loop.edge[i].func = -1;
+	    if (t > loop.edge[i].cost) loop.edge[i].cost = t;
+	}
+    }
+    path_calls(nodes, prev, last, NULL, loop.call, &loop.calls, rounds);
+    path_calls(nodes, prev, exit_node, exit_edge, loop.call, &loop.calls, 1);
+
+    for (int n = 0; n < count; n++) {
+	if (body[n] && n != header) nodes[n].alive = 0;
+	for (int e = 0; e < nodes[n].edges; e++) {
+	    int to = nodes[n].edge[e].to;
+	    if (to != EXIT && body[to] && !body[n]) nodes[n].edge[e].to = header;
+	}
+    }
+    nodes[header] = loop;
+}
+
+/* innermost loop first: the smallest body among remaining back edges */
+static int next_loop(struct Node *nodes, int count, char *best) {
+    int best_size = count + 1, header = -1;
+    char body[count], seen[count];
+    for (int h = 0; h < count; h++) {
+	if (!nodes[h].alive) continue;
+	memset(body, 0, count);
+	int size = 0;
+	for (int n = 0; n < count; n++) {
+	    if (!nodes[n].alive) continue;
+	    for (int e = 0; e < nodes[n].edges; e++) {
+		if (nodes[n].edge[e].to != h || n < h) continue;
+		for (int m = 0; m < count; m++) {
+		    if (!nodes[m].alive || body[m]) continue;
+		    memset(seen, 0, count);
+		    if (m == h || (reaches(nodes, h, m, -1, seen)
+				   && (memset(seen, 0, count),
+				       reaches(nodes, m, n, h, seen)))) {
+			body[m] = 1;
+			size++;
+		    }
+		}
+	    }
+	}
+	if (size > 0 && size < best_size) {
+	    best_size = size;
+	    header = h;
+	    memcpy(best, body, count);
+	}
+    }
+    return header;
+}
+
+static long long wcet(int f) {
+    struct Func *func = funcs + f;
+    if (func->state == 2) return func->wcet;
+    if (func->state == 1) {
+	fprintf(stderr, "ERROR: recursion through %s\n", func->name + 1);
+	exit(-ELOOP);
+    }
+    func->state = 1;
+    int size = func->last - func->first + 1;
+    struct Node *nodes = malloc(size * sizeof(*nodes));
+    int count = build_nodes(func, nodes);
+    char body[count + 1];
+    int header;
+    while ((header = next_loop(nodes, count, body)) >= 0) {
+	collapse(func, nodes, count, header, body);
+    }
+    long long dist[count + 1];
+    int prev[count + 1];
+    char all[count + 1];
+    memset(all, 1, count + 1);
+    func->wcet = 0;
+    if (count > 0) {
+	longest(nodes, count, 0, all, dist, prev);
+	int end = -1;
+	struct Edge *end_edge = NULL;
+	for (int n = 0; n < count; n++) {
+	    if (!nodes[n].alive || dist[n] < 0) continue;
+	    for (int e = 0; e < nodes[n].edges; e++) {
+		struct Edge *edge = nodes[n].edge + e;
+		if (edge->to == EXIT && dist[n] + edge->cost > func->wcet) {
+		    func->wcet = dist[n] + edge->cost;
+		    end = n;
+		    end_edge = edge;
+		}
+	    }
+	}
+	if (end >= 0) {
+	    path_calls(nodes, prev, end, end_edge, func->call, &func->calls, 1);
+	}
+    }
+    free(nodes);
+    func->state = 2;
+    return func->wcet;
+}
+
+static void print_path(struct Call *list, int calls, int depth) {
+    for (int i = 0; i < calls; i++) {
+	struct Call *call = list + i;
+	struct Func *func = funcs + call->func;
+	printf("%*s%s x%d T:%lld\n", 2 * depth, "", func->name + 1,
+	       call->count, call->cost);
+	if (depth < 8) print_path(func->call, func->calls, depth + 1);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+	printf("USAGE: z80-wcet program.asm budget [root]\n");
+	printf("  worst case T-states per function reachable from root\n");
+	printf("  (default game_loop), frame loop checked against budget\n");
+	return 0;
+    }
+    FILE *f = fopen(argv[1], "r");
+    if (f == NULL) return -ENOENT;
+    read_asm(f);
+    fclose(f);
+    find_taken();
+
+    char root[64];
+    snprintf(root, sizeof(root), "_%s", argc > 3 ? argv[3] : "game_loop");
+    int start = find_func(root);
+    if (start < 0) {
+	fprintf(stderr, "ERROR: no function %s\n", root + 1);
+	return -ENOENT;
+    }
+    wcet(start);
+    for (int i = 0; i < func_count; i++) {
+	if (funcs[i].state == 2) {
+	    printf("WCET:%s T:%lld\n", funcs[i].name + 1, funcs[i].wcet);
+	}
+	if (funcs[i].skip) printf("WCET:%s SKIP\n", funcs[i].name + 1);
+    }
+
+    long long budget = strtol(argv[2], NULL, 0);
+    if (frame_cost < 0) {
+	fprintf(stderr, "ERROR: no wcet: frame loop under %s\n", root + 1);
+	return -ENOENT;
+    }
+    printf("FRAME:%s T:%lld BUDGET:%lld USED:%lld%%\n", frame_func,
+	   frame_cost, budget, 100 * frame_cost / budget);
+    print_path(frame_call, frame_calls, 1);
+    if (unbounded) return 2;
+    return frame_cost > budget;
+}